@@ -0,0 +1,327 @@
+// ms-compress: implements Microsoft compression algorithms
+// Copyright (C) 2018 David Mulder <dmulder@suse.com>
+//
+// This library is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This library is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+
+////////////////////////////// Throughput Benchmark ////////////////////////////////////////////////
+// Compresses the synthetic corpus at a range of sizes and thread counts and prints one CSV row per
+// measurement to stdout (progress and errors go to stderr).
+//
+// Build (from the repository root):
+//   make xh_bench
+//
+// Usage:
+//   xh_bench [--types text,utf16,vm,random,compressed,records] [--sizes 512,4K,...]
+//            [--max-size 1G] [--threads 1,2,4] [--levels 1,5,9] [--memory-limit N]
+//            [--huge-pages] [--min-time 0.5] [--seed N]
+//   xh_bench --scaling N [--types ...] [--sizes 64M,...] [--levels 5] [--min-time 0.5] [--seed N]
+//
+// With more than one thread the input is split into chunk-aligned slices that are compressed as
+// independent streams, one slice at a time per thread, each thread with its own context. Inputs
+// smaller than threads*64 KiB leave some threads idle, so they show no scaling. With --memory-limit
+// the limit is shared by the threads (see xpress_huff_ctx_set_memory_limit). --huge-pages enables
+// xpress_huff_ctx_set_huge_pages.
+//
+// Columns:
+//   type, size, threads     the measurement
+//   level                   the compression level
+//   iterations              number of times the whole input was compressed
+//   out_size                compressed size of one iteration (sum of all slices)
+//   ratio                   size / out_size
+//   mb_per_s                aggregate throughput in MB/s (10^6 bytes of input per second)
+//   cycles_per_byte         wall-clock reference cycles * threads / input bytes (0 if unavailable)
+//
+// Thread-scaling mode (--scaling N) runs every thread count from 1 to N on each size (default 64 MiB)
+// and prints a different set of columns:
+//   type, size, threads, level, mb_per_s
+//   speedup                 mb_per_s / mb_per_s with 1 thread
+//   efficiency              speedup / threads
+//   peak_bytes              peak memory allocated by the library at once, over all threads
+//   bytes_per_thread        peak_bytes / threads
+//   model_bytes_per_thread  xpress_huff_memory_usage for one slice (an upper bound of bytes_per_thread
+//                           without --huge-pages, which allocates a whole 2 MiB block)
+//
+// There is no decompressor in this library, so only compression is measured.
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <getopt.h>
+
+#include "../src/xpress_huff_compress.h"
+#include "corpus.h"
+
+// The library's allocations are tracked to report its peak memory use. Linked with -Wl,--wrap for
+// malloc, calloc, posix_memalign and free, so that every allocation comes here (the compiler may
+// turn a malloc followed by a memset into calloc). The 16 bytes in front of each block hold its size
+// and the pointer returned by the real allocator.
+static size_t bench_live_bytes, bench_peak_bytes;
+void* __real_malloc(size_t n);
+int __real_posix_memalign(void** p, size_t alignment, size_t n);
+void __real_free(void* x);
+static void* bench_track(void* base, uint8_t* x, size_t n)
+{
+	((size_t*)x)[-2] = n;
+	((void**)x)[-1] = base;
+	const size_t live = __atomic_add_fetch(&bench_live_bytes, n, __ATOMIC_RELAXED);
+	size_t peak = __atomic_load_n(&bench_peak_bytes, __ATOMIC_RELAXED);
+	while (live > peak && !__atomic_compare_exchange_n(&bench_peak_bytes, &peak, live, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) { }
+	return x;
+}
+void* __wrap_malloc(size_t n)
+{
+	uint8_t* p = (uint8_t*)__real_malloc(n + 16);
+	return p ? bench_track(p, p + 16, n) : NULL;
+}
+void* __wrap_calloc(size_t n, size_t size)
+{
+	void* x = __wrap_malloc(n * size);
+	if (x) { memset(x, 0, n * size); }
+	return x;
+}
+int __wrap_posix_memalign(void** x, size_t alignment, size_t n)
+{
+	void* p;
+	const int err = __real_posix_memalign(&p, alignment, n + MAX(alignment, 16));
+	if (err == 0) { *x = bench_track(p, (uint8_t*)p + MAX(alignment, 16), n); }
+	return err;
+}
+void __wrap_free(void* x)
+{
+	if (!x) { return; }
+	__atomic_sub_fetch(&bench_live_bytes, ((size_t*)x)[-2], __ATOMIC_RELAXED);
+	__real_free(((void**)x)[-1]);
+}
+
+#define CHUNK_SIZE		XPRESS_HUFF_CHUNK_SIZE
+
+#define MAX_LIST		64
+
+static int bench_huge_pages;
+
+typedef struct
+{
+	const uint8_t* in;
+	size_t len, slice_len;
+	uint8_t* out;          // out_cap bytes for each slice
+	size_t out_cap;
+	size_t* out_lens;      // one per slice
+	unsigned threads, index;
+	int level;
+	size_t memory_limit;
+	int huge_pages;
+	uint64_t iterations;
+	pthread_barrier_t* barrier;
+	int error;
+} bench_job;
+
+static void* bench_worker(void* arg)
+{
+	bench_job* job = (bench_job*)arg;
+	const size_t n_slices = (job->len + job->slice_len - 1) / job->slice_len;
+	if (job->barrier) { pthread_barrier_wait(job->barrier); }
+	xpress_huff_ctx* ctx = xpress_huff_ctx_new();
+	if (!ctx) { job->error = ENOMEM; return NULL; }
+	xpress_huff_ctx_set_level(ctx, job->level);
+	xpress_huff_ctx_set_memory_limit(ctx, job->memory_limit);
+	xpress_huff_ctx_set_huge_pages(ctx, job->huge_pages);
+	for (uint64_t it = 0; it < job->iterations && !job->error; ++it)
+	{
+		for (size_t s = job->index; s < n_slices; s += job->threads)
+		{
+			const size_t off = s * job->slice_len, len = MIN(job->slice_len, job->len - off);
+			size_t out_len = job->out_cap;
+			const int err = xpress_huff_compress_ctx(ctx, job->in + off, len, job->out + s * job->out_cap, &out_len, NULL);
+			if (err) { job->error = err; break; }
+			job->out_lens[s] = out_len;
+		}
+	}
+	xpress_huff_ctx_free(ctx);
+	return NULL;
+}
+
+// Runs iterations of compressing in with the given number of threads, returning the wall-clock time
+static int bench_run(const uint8_t* in, size_t len, unsigned threads, int level, size_t memory_limit, uint64_t iterations, uint8_t* out, size_t* out_lens, uint64_t* ns, uint64_t* cycles)
+{
+	bench_job jobs[MAX_LIST];
+	pthread_t tids[MAX_LIST];
+	pthread_barrier_t barrier;
+	const size_t per_thread = (len + threads - 1) / threads;
+	const size_t slice_len = MAX(CHUNK_SIZE, (per_thread + CHUNK_SIZE - 1) / CHUNK_SIZE * CHUNK_SIZE);
+	const size_t out_cap = xpress_huff_max_compressed_size(MIN(slice_len, len));
+	int err = 0;
+
+	if (threads > 1) { pthread_barrier_init(&barrier, NULL, threads + 1); }
+	for (unsigned t = 0; t < threads; ++t)
+	{
+		jobs[t] = (bench_job){ in, len, slice_len, out, out_cap, out_lens, threads, t, level, memory_limit / threads, bench_huge_pages, iterations, threads > 1 ? &barrier : NULL, 0 };
+		if (threads > 1) { pthread_create(&tids[t], NULL, bench_worker, &jobs[t]); }
+	}
+	if (threads > 1) { pthread_barrier_wait(&barrier); }
+	const uint64_t start = bench_now_ns(), start_cycles = bench_cycles();
+	if (threads > 1) { for (unsigned t = 0; t < threads; ++t) { pthread_join(tids[t], NULL); } }
+	else { bench_worker(&jobs[0]); }
+	*cycles = bench_cycles() - start_cycles;
+	*ns = bench_now_ns() - start;
+	if (threads > 1) { pthread_barrier_destroy(&barrier); }
+	for (unsigned t = 0; t < threads; ++t) { if (jobs[t].error) { err = jobs[t].error; } }
+	return err;
+}
+
+// Runs bench_run with enough iterations to take at least min_time
+static int bench_measure(const uint8_t* in, size_t len, unsigned threads, int level, size_t memory_limit, double min_time, uint8_t* out, size_t* out_lens, uint64_t* iterations, uint64_t* ns, uint64_t* cycles)
+{
+	// Calibrate by doubling the iterations until a tenth of the time is reached (this also warms up
+	// caches and the allocator), then scale up. A long enough calibration run is used as is.
+	int err;
+	*iterations = 1;
+	for (;;)
+	{
+		if ((err = bench_run(in, len, threads, level, memory_limit, *iterations, out, out_lens, ns, cycles)) != 0) { return err; }
+		if (*ns >= min_time * 1e8) { break; }
+		*iterations <<= 1;
+	}
+	if (*ns < min_time * 1e9)
+	{
+		*iterations = (uint64_t)(*iterations * min_time * 1e9 / *ns) + 1;
+		err = bench_run(in, len, threads, level, memory_limit, *iterations, out, out_lens, ns, cycles);
+	}
+	return err;
+}
+
+int main(int argc, char* argv[])
+{
+	size_t sizes[MAX_LIST] = { 512, 4<<10, 32<<10, 256<<10, 2<<20, 16<<20, 128<<20, 1<<30 }, n_sizes = 8;
+	size_t threads[MAX_LIST] = { 1 }, n_threads = 1;
+	size_t levels[MAX_LIST] = { 1, XPRESS_HUFF_DEFAULT_LEVEL, XPRESS_HUFF_MAX_LEVEL }, n_levels = 3;
+	size_t max_size = (size_t)1 << 30, scaling = 0, memory_limit = 0;
+	int sizes_given = 0, levels_given = 0;
+	double min_time = 0.5;
+	uint64_t seed = 1;
+	int types[CORPUS_COUNT], n_types = CORPUS_COUNT;
+	for (int i = 0; i < CORPUS_COUNT; ++i) { types[i] = i; }
+
+	static const struct option opts[] = {
+		{ "types",    required_argument, NULL, 't' },
+		{ "sizes",    required_argument, NULL, 's' },
+		{ "max-size", required_argument, NULL, 'm' },
+		{ "threads",  required_argument, NULL, 'j' },
+		{ "levels",   required_argument, NULL, 'l' },
+		{ "memory-limit", required_argument, NULL, 'M' },
+		{ "huge-pages", no_argument,     NULL, 'H' },
+		{ "min-time", required_argument, NULL, 'T' },
+		{ "seed",     required_argument, NULL, 'S' },
+		{ "scaling",  required_argument, NULL, 'x' },
+		{ NULL, 0, NULL, 0 }
+	};
+	for (int c; (c = getopt_long(argc, argv, "t:s:m:j:l:M:HT:S:x:", opts, NULL)) != -1; )
+	{
+		switch (c)
+		{
+		case 't':
+			n_types = 0;
+			for (char* name = strtok(optarg, ","); name && n_types < CORPUS_COUNT; name = strtok(NULL, ","))
+			{
+				if ((types[n_types] = corpus_from_name(name)) < 0) { fprintf(stderr, "unknown corpus type: %s\n", name); return 1; }
+				++n_types;
+			}
+			break;
+		case 's': n_sizes = bench_parse_list(optarg, sizes, MAX_LIST); sizes_given = 1; break;
+		case 'm': max_size = bench_parse_size(optarg); break;
+		case 'j': n_threads = bench_parse_list(optarg, threads, MAX_LIST); break;
+		case 'l': n_levels = bench_parse_list(optarg, levels, MAX_LIST); levels_given = 1; break;
+		case 'M': memory_limit = bench_parse_size(optarg); break;
+		case 'H': bench_huge_pages = 1; break;
+		case 'T': min_time = atof(optarg); break;
+		case 'S': seed = strtoull(optarg, NULL, 0); break;
+		case 'x':
+			scaling = (size_t)strtoull(optarg, NULL, 0);
+			n_threads = 0;
+			for (size_t t = 1; t <= scaling && n_threads < MAX_LIST; ++t) { threads[n_threads++] = t; }
+			break;
+		default:
+			fprintf(stderr, "usage: %s [--types list] [--sizes list] [--max-size N] [--threads list | --scaling N] [--levels list] [--memory-limit N] [--huge-pages] [--min-time sec] [--seed N]\n", argv[0]);
+			return 1;
+		}
+	}
+
+	if (scaling && !sizes_given) { sizes[0] = 64<<20; n_sizes = 1; }
+	if (scaling && !levels_given) { levels[0] = XPRESS_HUFF_DEFAULT_LEVEL; n_levels = 1; }
+	for (size_t i = 0; i < n_levels; ++i) { if (levels[i] < XPRESS_HUFF_MIN_LEVEL || levels[i] > XPRESS_HUFF_MAX_LEVEL) { fprintf(stderr, "level must be %d-%d\n", XPRESS_HUFF_MIN_LEVEL, XPRESS_HUFF_MAX_LEVEL); return 1; } }
+	size_t largest = 0;
+	for (size_t i = 0; i < n_sizes; ++i) { if (sizes[i] <= max_size) { largest = MAX(largest, sizes[i]); } }
+	for (size_t i = 0; i < n_threads; ++i) { if (threads[i] == 0 || threads[i] > MAX_LIST) { fprintf(stderr, "thread count must be 1-%d\n", MAX_LIST); return 1; } }
+	if (largest == 0) { fprintf(stderr, "no sizes to run\n"); return 1; }
+
+	// Worst case output: every slice is at least one chunk, each needs its own worst-case space
+	const size_t out_total = xpress_huff_max_compressed_size(largest) + MAX_LIST * xpress_huff_max_compressed_size(CHUNK_SIZE);
+	uint8_t* in = (uint8_t*)malloc(largest), *out = (uint8_t*)malloc(out_total);
+	size_t* out_lens = (size_t*)malloc((largest / CHUNK_SIZE + MAX_LIST) * sizeof(size_t));
+	if (!in || !out || !out_lens) { fprintf(stderr, "unable to allocate %zu bytes\n", largest + out_total); return 1; }
+
+	if (scaling) { printf("type,size,threads,level,mb_per_s,speedup,efficiency,peak_bytes,bytes_per_thread,model_bytes_per_thread\n"); }
+	else { printf("type,size,threads,level,iterations,out_size,ratio,mb_per_s,cycles_per_byte\n"); }
+	for (int ti = 0; ti < n_types; ++ti)
+	{
+		fprintf(stderr, "generating %s corpus (%zu bytes)\n", corpus_names[types[ti]], largest);
+		corpus_generate((corpus_type)types[ti], in, largest, seed);
+		for (size_t si = 0; si < n_sizes; ++si)
+		{
+			const size_t len = sizes[si];
+			if (len > max_size || len == 0) { continue; }
+			for (size_t li = 0; li < n_levels; ++li)
+			{
+				const int level = (int)levels[li];
+				double base_mbps = 0;
+				for (size_t ji = 0; ji < n_threads; ++ji)
+				{
+					const unsigned t = (unsigned)threads[ji];
+					const size_t slice_len = MAX(CHUNK_SIZE, ((len + t - 1) / t + CHUNK_SIZE - 1) / CHUNK_SIZE * CHUNK_SIZE);
+					uint64_t ns, cycles, iterations;
+					int err;
+					if ((err = bench_measure(in, len, t, level, memory_limit, min_time, out, out_lens, &iterations, &ns, &cycles)) != 0) { fprintf(stderr, "compression failed: %d\n", err); return 1; }
+
+					const double bytes = (double)len * iterations, mbps = bytes / ns * 1e3;
+					if (scaling)
+					{
+						// Measure the peak with exactly one iteration, after the timed runs, not counting the
+						// benchmark's own buffers that are live already
+						uint64_t one_ns, one_cycles;
+						const size_t base_bytes = bench_live_bytes;
+						bench_peak_bytes = base_bytes;
+						if ((err = bench_run(in, len, t, level, memory_limit, 1, out, out_lens, &one_ns, &one_cycles)) != 0) { fprintf(stderr, "compression failed: %d\n", err); return 1; }
+						if (t == 1) { base_mbps = mbps; }
+						printf("%s,%zu,%u,%d,%.2f,%.3f,%.3f,%zu,%zu,%zu\n", corpus_names[types[ti]], len, t, level, mbps, mbps / base_mbps, mbps / base_mbps / t,
+							bench_peak_bytes - base_bytes, (bench_peak_bytes - base_bytes) / t, xpress_huff_memory_usage(level, 1, MIN(slice_len, len)));
+					}
+					else
+					{
+						size_t comp = 0;
+						for (size_t s = 0; s * slice_len < len; ++s) { comp += out_lens[s]; }
+						printf("%s,%zu,%u,%d,%llu,%zu,%.4f,%.2f,%.3f\n", corpus_names[types[ti]], len, t, level, (unsigned long long)iterations, comp,
+							(double)len / comp, mbps, (double)cycles * t / bytes);
+					}
+					fflush(stdout);
+				}
+			}
+		}
+	}
+
+	free(in); free(out); free(out_lens);
+	return 0;
+}
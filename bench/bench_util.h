@@ -0,0 +1,102 @@
+// ms-compress: implements Microsoft compression algorithms
+// Copyright (C) 2018 David Mulder <dmulder@suse.com>
+//
+// This library is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This library is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+
+////////////////////////////// Benchmark Utilities /////////////////////////////////////////////////
+// Clocks, a deterministic PRNG and size parsing shared by the benchmarks.
+// Cycle counts come from the TSC on x86 (reference cycles, not core cycles) and from the virtual
+// counter on aarch64. Elsewhere they are not available and are reported as 0.
+
+#ifndef MSCOMP_BENCH_UTIL_H
+#define MSCOMP_BENCH_UTIL_H
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+#include "../src/mscomp_endian.h"
+
+#ifndef MIN
+#define MIN(a, b) (((a) < (b)) ? (a) : (b))
+#endif
+#ifndef MAX
+#define MAX(a, b) (((a) > (b)) ? (a) : (b))
+#endif
+
+static inline uint64_t bench_now_ns(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000u + (uint64_t)ts.tv_nsec;
+}
+
+static inline uint64_t bench_cycles(void)
+{
+#if defined(__x86_64__) || defined(__i386__)
+	return __rdtsc();
+#elif defined(__aarch64__)
+	uint64_t x;
+	__asm__ __volatile__("mrs %0, cntvct_el0" : "=r"(x));
+	return x;
+#else
+	return 0;
+#endif
+}
+
+// xorshift64*, seeded so that every run generates the exact same corpus
+typedef struct { uint64_t s; } bench_rng;
+
+static inline void bench_rng_seed(bench_rng *r, uint64_t seed) { r->s = seed ? seed : 0x9E3779B97F4A7C15ull; }
+static inline uint32_t bench_rng_next(bench_rng *r)
+{
+	r->s ^= r->s >> 12; r->s ^= r->s << 25; r->s ^= r->s >> 27;
+	return (uint32_t)((r->s * 0x2545F4914F6CDD1Dull) >> 32);
+}
+static inline uint32_t bench_rng_below(bench_rng *r, uint32_t n) { return (uint32_t)(((uint64_t)bench_rng_next(r) * n) >> 32); }
+
+// Parses sizes like "512", "64K", "16M" or "1G" (powers of 1024)
+static inline size_t bench_parse_size(const char* s)
+{
+	char* end;
+	size_t x = (size_t)strtoull(s, &end, 10);
+	switch (*end)
+	{
+	case 'g': case 'G': x <<= 10; // fallthrough
+	case 'm': case 'M': x <<= 10; // fallthrough
+	case 'k': case 'K': x <<= 10;
+	}
+	return x;
+}
+
+// Parses a comma separated list of sizes, returns the number parsed
+static inline size_t bench_parse_list(const char* s, size_t* vals, size_t max)
+{
+	size_t n = 0;
+	while (*s && n < max)
+	{
+		vals[n++] = bench_parse_size(s);
+		s = strchr(s, ',');
+		if (!s) { break; }
+		++s;
+	}
+	return n;
+}
+
+#endif
@@ -0,0 +1,190 @@
+// ms-compress: implements Microsoft compression algorithms
+// Copyright (C) 2018 David Mulder <dmulder@suse.com>
+//
+// This library is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This library is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+
+////////////////////////////// Synthetic Corpus ////////////////////////////////////////////////////
+// Generates the benchmark inputs so that no external files are needed and every run sees the exact
+// same bytes. Each generator fills the whole buffer and only depends on the seed, so a prefix of a
+// large buffer is a valid smaller input of the same kind.
+
+#ifndef MSCOMP_BENCH_CORPUS_H
+#define MSCOMP_BENCH_CORPUS_H
+
+#include "bench_util.h"
+#include "../src/xpress_huff_compress.h"
+
+#define CORPUS_WORDS		2048
+#define CORPUS_BLOCK		0x1000
+#define CORPUS_RECORD		64
+
+typedef enum { CORPUS_TEXT, CORPUS_UTF16, CORPUS_VM, CORPUS_RANDOM, CORPUS_COMPRESSED, CORPUS_RECORDS, CORPUS_COUNT } corpus_type;
+
+static const char* const corpus_names[CORPUS_COUNT] = { "text", "utf16", "vm", "random", "compressed", "records" };
+
+static inline int corpus_from_name(const char* name)
+{
+	for (int i = 0; i < CORPUS_COUNT; ++i) { if (strcmp(name, corpus_names[i]) == 0) { return i; } }
+	return -1;
+}
+
+// English-like text: words from a fixed vocabulary picked with a roughly Zipfian distribution
+static inline void corpus_text(uint8_t* out, size_t len, uint64_t seed)
+{
+	static const char letters[] = "etaoinshrdlcumwfgypbvkjxqz";
+	char words[CORPUS_WORDS][12];
+	bench_rng r;
+	bench_rng_seed(&r, seed);
+	for (uint_fast16_t i = 0; i < CORPUS_WORDS; ++i)
+	{
+		uint_fast8_t n = 1 + bench_rng_below(&r, 3) + bench_rng_below(&r, 4) + bench_rng_below(&r, 4);
+		for (uint_fast8_t j = 0; j < n; ++j) { words[i][j] = letters[bench_rng_below(&r, bench_rng_below(&r, 26) + 1)]; }
+		words[i][n] = 0;
+	}
+
+	size_t pos = 0;
+	uint_fast16_t sentence = 0;
+	while (pos < len)
+	{
+		// the product of two uniform numbers skews heavily towards the common (low index) words
+		const uint32_t w = (uint32_t)(((uint64_t)bench_rng_below(&r, CORPUS_WORDS) * bench_rng_below(&r, CORPUS_WORDS)) / CORPUS_WORDS);
+		for (const char* c = words[w]; *c && pos < len; ++c) { out[pos++] = (sentence == 0 && c == words[w]) ? (uint8_t)(*c - 32) : (uint8_t)*c; }
+		if (pos >= len) { break; }
+		if (++sentence > 6 + bench_rng_below(&r, 12))
+		{
+			out[pos++] = '.';
+			if (pos < len) { out[pos++] = bench_rng_below(&r, 5) ? ' ' : '\n'; }
+			sentence = 0;
+		}
+		else { out[pos++] = bench_rng_below(&r, 12) ? ' ' : ','; }
+	}
+}
+
+// UTF-16LE text: the text corpus with some non-ASCII characters, as written by Windows
+static inline void corpus_utf16(uint8_t* out, size_t len, uint64_t seed)
+{
+	static const uint16_t extra[] = { 0x00E9, 0x00FC, 0x00F1, 0x00DF, 0x0431, 0x0434, 0x65E5, 0x672C, 0x8A9E };
+	const size_t n = (len + 1) / 2;
+	uint8_t* text = (uint8_t*)malloc(n);
+	bench_rng r;
+	corpus_text(text, n, seed);
+	bench_rng_seed(&r, seed ^ 0x5555);
+	for (size_t i = 0; i < n; ++i)
+	{
+		const uint16_t c = (text[i] >= 'a' && bench_rng_below(&r, 40) == 0) ? extra[bench_rng_below(&r, sizeof(extra)/sizeof(extra[0]))] : text[i];
+		out[2*i] = (uint8_t)c;
+		if (2*i+1 < len) { out[2*i+1] = (uint8_t)(c >> 8); }
+	}
+	free(text);
+}
+
+// Virtual machine disk blocks: mostly zero pages, sparse tables, some text and some random data
+static inline void corpus_vm(uint8_t* out, size_t len, uint64_t seed)
+{
+	const size_t text_len = 0x40000;
+	uint8_t* text = (uint8_t*)malloc(text_len);
+	bench_rng r;
+	bench_rng_seed(&r, seed);
+	corpus_text(text, text_len, seed);
+	memset(out, 0, len);
+	for (size_t pos = 0; pos < len; pos += CORPUS_BLOCK)
+	{
+		const size_t n = MIN(CORPUS_BLOCK, len - pos);
+		const uint32_t kind = bench_rng_below(&r, 20);
+		if (kind < 12) { continue; } // zero page
+		else if (kind < 15)
+		{
+			// sparse page: mostly zero with 8-byte entries every so often (page tables, bitmaps)
+			for (size_t i = 0; i + 8 <= n; i += 8) { if (bench_rng_below(&r, 6) == 0) { SET_UINT32_RAW(out+pos+i, (bench_rng_next(&r) & 0xFFFFF000) | 0x63); } }
+		}
+		else if (kind < 18) { memcpy(out+pos, text + bench_rng_below(&r, text_len/CORPUS_BLOCK)*CORPUS_BLOCK, n); }
+		else { for (size_t i = 0; i < n; ++i) { out[pos+i] = (uint8_t)bench_rng_next(&r); } }
+	}
+	free(text);
+}
+
+static inline void corpus_random(uint8_t* out, size_t len, uint64_t seed)
+{
+	bench_rng r;
+	bench_rng_seed(&r, seed);
+	size_t i = 0;
+	for (; i + 4 <= len; i += 4) { SET_UINT32_RAW(out+i, bench_rng_next(&r)); }
+	for (; i < len; ++i) { out[i] = (uint8_t)bench_rng_next(&r); }
+}
+
+// Data that is already compressed: the text corpus compressed with Xpress Huffman in 1 MiB pieces
+// The pieces are generated once (8 MiB) and repeated, which is far outside of the window
+static inline void corpus_compressed(uint8_t* out, size_t len, uint64_t seed)
+{
+	const size_t piece = 0x100000, pool_len = MIN(len, 8*piece);
+	uint8_t* text = (uint8_t*)malloc(piece);
+	size_t pos = 0;
+	for (uint64_t i = 0; pos < pool_len; ++i)
+	{
+		size_t out_len = xpress_huff_max_compressed_size(piece);
+		uint8_t* comp = (uint8_t*)malloc(out_len);
+		corpus_text(text, piece, seed + i);
+		if (xpress_huff_compress(text, piece, comp, &out_len) != 0) { out_len = 0; }
+		out_len = MIN(out_len, pool_len - pos);
+		memcpy(out+pos, comp, out_len);
+		pos += out_len;
+		free(comp);
+	}
+	free(text);
+	for (; pos < len; pos += pool_len) { memcpy(out+pos, out, MIN(pool_len, len - pos)); }
+}
+
+// Structured binary records (64 bytes each): ids, timestamps, enums, a random walk and a name
+static inline void corpus_records(uint8_t* out, size_t len, uint64_t seed)
+{
+	static const char* const names[] = { "alpha", "bravo", "charlie", "delta", "echo", "foxtrot", "golf", "hotel" };
+	uint8_t rec[CORPUS_RECORD];
+	bench_rng r;
+	uint64_t id = 1000000, ts = 1500000000000ull;
+	double value = 100.0;
+	bench_rng_seed(&r, seed);
+	for (size_t pos = 0; pos < len; pos += CORPUS_RECORD)
+	{
+		memset(rec, 0, sizeof(rec));
+		id += 1 + (bench_rng_below(&r, 8) == 0);
+		ts += bench_rng_below(&r, 2000);
+		value += ((double)bench_rng_below(&r, 2001) - 1000.0) / 100.0;
+		SET_UINT32_RAW(rec+0, (uint32_t)id); SET_UINT32_RAW(rec+4, (uint32_t)(id >> 32));
+		SET_UINT32_RAW(rec+8, (uint32_t)ts); SET_UINT32_RAW(rec+12, (uint32_t)(ts >> 32));
+		SET_UINT32_RAW(rec+16, bench_rng_below(&r, 8));
+		SET_UINT32_RAW(rec+20, 1u << bench_rng_below(&r, 4));
+		memcpy(rec+24, &value, sizeof(value));
+		strcpy((char*)rec+32, names[bench_rng_below(&r, 8)]);
+		SET_UINT32_RAW(rec+60, bench_rng_next(&r));
+		memcpy(out+pos, rec, MIN(CORPUS_RECORD, len - pos));
+	}
+}
+
+// Fills out with len bytes of the given corpus type
+static inline void corpus_generate(corpus_type type, uint8_t* out, size_t len, uint64_t seed)
+{
+	switch (type)
+	{
+	case CORPUS_TEXT:       corpus_text(out, len, seed); break;
+	case CORPUS_UTF16:      corpus_utf16(out, len, seed); break;
+	case CORPUS_VM:         corpus_vm(out, len, seed); break;
+	case CORPUS_RANDOM:     corpus_random(out, len, seed); break;
+	case CORPUS_COMPRESSED: corpus_compressed(out, len, seed); break;
+	case CORPUS_RECORDS:    corpus_records(out, len, seed); break;
+	default: break;
+	}
+}
+
+#endif
@@ -0,0 +1,211 @@
+// ms-compress: implements Microsoft compression algorithms
+// Copyright (C) 2018 David Mulder <dmulder@suse.com>
+//
+// This library is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This library is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+
+////////////////////////////// Small-Message Latency Benchmark /////////////////////////////////////
+// Compresses small messages (512 B - 64 KiB) one after another and reports the latency distribution
+// of the individual calls, with a fresh context each call (xpress_huff_compress) and with a reused
+// context (xpress_huff_compress_ctx). Each call compresses the next of 64 different messages so the
+// input is not always hot in the cache. With --huge-pages the reused context is also run with huge
+// pages enabled (xpress_huff_ctx_set_huge_pages). With --dict it is also run with a 64 KiB preset
+// dictionary (xpress_huff_ctx_set_dict) of the same type of data as the messages.
+//
+// Allocations made by the library are counted by wrapping malloc at link time. Cache misses and
+// dTLB misses are counted with perf_event_open when it is available (Linux, with a permissive
+// perf_event_paranoid), otherwise they are reported as -1.
+//
+// Build (from the repository root):
+//   make xh_latency
+//
+// Usage:
+//   xh_latency [--types text,records] [--sizes 512,1K,...] [--calls 20000] [--huge-pages] [--dict]
+//
+// Columns:
+//   type, size, mode                        the measurement (mode is "oneshot", "reuse", "reuse_huge" or "reuse_dict")
+//   calls                                   number of calls timed
+//   p50_ns, p99_ns, p999_ns, max_ns         latency percentiles of a single call
+//   mean_ns
+//   allocs_per_call, alloc_bytes_per_call   library allocations
+//   cache_misses_per_call, dtlb_misses_per_call
+//   ratio                                   compressed size / input size of all of the calls
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <getopt.h>
+#ifdef __linux__
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+#endif
+
+#include "../src/xpress_huff_compress.h"
+#include "corpus.h"
+
+// Linked with -Wl,--wrap=malloc,--wrap=calloc, so every allocation (the library's included) comes
+// here. The counters are reset right before the timed calls, so only the library's allocations are
+// counted.
+static uint64_t lat_allocs, lat_alloc_bytes;
+void* __real_malloc(size_t n);
+void* __real_calloc(size_t n, size_t size);
+void* __wrap_malloc(size_t n) { ++lat_allocs; lat_alloc_bytes += n; return __real_malloc(n); }
+void* __wrap_calloc(size_t n, size_t size) { ++lat_allocs; lat_alloc_bytes += n * size; return __real_calloc(n, size); }
+
+#define MAX_LIST		64
+#define MESSAGES		64
+#define DICT_SIZE		0x10000
+
+enum { MODE_ONESHOT, MODE_REUSE, MODE_REUSE_HUGE, MODE_REUSE_DICT, MODES };
+static const char* const mode_names[MODES] = { "oneshot", "reuse", "reuse_huge", "reuse_dict" };
+
+typedef struct { int fd; } lat_counter;
+
+static void lat_counter_open(lat_counter* c, uint32_t type, uint64_t config)
+{
+	c->fd = -1;
+#ifdef __linux__
+	struct perf_event_attr attr;
+	memset(&attr, 0, sizeof(attr));
+	attr.size = sizeof(attr);
+	attr.type = type;
+	attr.config = config;
+	attr.disabled = 1;
+	attr.exclude_kernel = 1;
+	attr.exclude_hv = 1;
+	c->fd = (int)syscall(__NR_perf_event_open, &attr, 0, -1, -1, 0);
+#endif
+}
+static void lat_counter_start(lat_counter* c)
+{
+#ifdef __linux__
+	if (c->fd >= 0) { ioctl(c->fd, PERF_EVENT_IOC_RESET, 0); ioctl(c->fd, PERF_EVENT_IOC_ENABLE, 0); }
+#endif
+}
+static int64_t lat_counter_stop(lat_counter* c)
+{
+	int64_t x = -1;
+#ifdef __linux__
+	if (c->fd >= 0 && (ioctl(c->fd, PERF_EVENT_IOC_DISABLE, 0), read(c->fd, &x, sizeof(x))) != sizeof(x)) { x = -1; }
+#endif
+	return x;
+}
+
+static int cmp_u64(const void* a, const void* b) { const uint64_t x = *(const uint64_t*)a, y = *(const uint64_t*)b; return (x > y) - (x < y); }
+
+int main(int argc, char* argv[])
+{
+	size_t sizes[MAX_LIST] = { 512, 1<<10, 2<<10, 4<<10, 8<<10, 16<<10, 32<<10, 64<<10 }, n_sizes = 8;
+	size_t calls = 20000;
+	int huge_pages = 0, dict = 0;
+	int types[CORPUS_COUNT] = { CORPUS_TEXT, CORPUS_RECORDS }, n_types = 2;
+
+	static const struct option opts[] = {
+		{ "types", required_argument, NULL, 't' },
+		{ "sizes", required_argument, NULL, 's' },
+		{ "calls", required_argument, NULL, 'n' },
+		{ "huge-pages", no_argument, NULL, 'H' },
+		{ "dict", no_argument, NULL, 'D' },
+		{ NULL, 0, NULL, 0 }
+	};
+	for (int c; (c = getopt_long(argc, argv, "t:s:n:HD", opts, NULL)) != -1; )
+	{
+		switch (c)
+		{
+		case 't':
+			n_types = 0;
+			for (char* name = strtok(optarg, ","); name && n_types < CORPUS_COUNT; name = strtok(NULL, ","))
+			{
+				if ((types[n_types] = corpus_from_name(name)) < 0) { fprintf(stderr, "unknown corpus type: %s\n", name); return 1; }
+				++n_types;
+			}
+			break;
+		case 's': n_sizes = bench_parse_list(optarg, sizes, MAX_LIST); break;
+		case 'n': calls = (size_t)strtoull(optarg, NULL, 0); break;
+		case 'H': huge_pages = 1; break;
+		case 'D': dict = 1; break;
+		default:
+			fprintf(stderr, "usage: %s [--types list] [--sizes list] [--calls N] [--huge-pages] [--dict]\n", argv[0]);
+			return 1;
+		}
+	}
+	if (calls == 0) { return 1; }
+
+	size_t largest = 0;
+	for (size_t i = 0; i < n_sizes; ++i) { largest = MAX(largest, sizes[i]); }
+	const size_t out_cap = xpress_huff_max_compressed_size(largest);
+	uint8_t* in = (uint8_t*)malloc(largest * MESSAGES), *out = (uint8_t*)malloc(out_cap), *dict_data = (uint8_t*)malloc(DICT_SIZE);
+	uint64_t* lat = (uint64_t*)malloc(calls * sizeof(uint64_t));
+	if (!in || !out || !dict_data || !lat) { fprintf(stderr, "out of memory\n"); return 1; }
+
+	lat_counter misses, tlb;
+	lat_counter_open(&misses, PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES);
+	lat_counter_open(&tlb, PERF_TYPE_HW_CACHE, PERF_COUNT_HW_CACHE_DTLB | (PERF_COUNT_HW_CACHE_OP_READ << 8) | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16));
+	if (misses.fd < 0) { fprintf(stderr, "perf_event_open not available, cache misses are not counted\n"); }
+
+	printf("type,size,mode,calls,p50_ns,p99_ns,p999_ns,max_ns,mean_ns,allocs_per_call,alloc_bytes_per_call,cache_misses_per_call,dtlb_misses_per_call,ratio\n");
+	for (int ti = 0; ti < n_types; ++ti)
+	{
+		corpus_generate((corpus_type)types[ti], in, largest * MESSAGES, 21);
+		corpus_generate((corpus_type)types[ti], dict_data, DICT_SIZE, 22);
+		for (size_t si = 0; si < n_sizes; ++si)
+		{
+			const size_t len = sizes[si];
+			for (int mode = 0; mode < MODES; ++mode)
+			{
+				if ((mode == MODE_REUSE_HUGE && !huge_pages) || (mode == MODE_REUSE_DICT && !dict)) { continue; }
+				const int reuse = mode != MODE_ONESHOT;
+				xpress_huff_ctx* ctx = reuse ? xpress_huff_ctx_new() : NULL;
+				int err = 0;
+				if (mode == MODE_REUSE_HUGE) { xpress_huff_ctx_set_huge_pages(ctx, 1); }
+				if (mode == MODE_REUSE_DICT) { err = xpress_huff_ctx_set_dict(ctx, dict_data, DICT_SIZE); }
+				uint64_t total = 0, total_out = 0;
+
+				// Warm up (also lets the reused context allocate its buffers before counting)
+				for (size_t i = 0; i < MESSAGES && !err; ++i)
+				{
+					size_t out_len = out_cap;
+					err = reuse ? xpress_huff_compress_ctx(ctx, in + i * largest, len, out, &out_len, NULL) : xpress_huff_compress(in + i * largest, len, out, &out_len);
+				}
+
+				lat_allocs = lat_alloc_bytes = 0;
+				lat_counter_start(&misses); lat_counter_start(&tlb);
+				for (size_t i = 0; i < calls && !err; ++i)
+				{
+					const uint8_t* msg = in + (i % MESSAGES) * largest;
+					size_t out_len = out_cap;
+					const uint64_t start = bench_now_ns();
+					err = reuse ? xpress_huff_compress_ctx(ctx, msg, len, out, &out_len, NULL) : xpress_huff_compress(msg, len, out, &out_len);
+					total += lat[i] = bench_now_ns() - start;
+					total_out += out_len;
+				}
+				const int64_t n_misses = lat_counter_stop(&misses), n_tlb = lat_counter_stop(&tlb);
+				xpress_huff_ctx_free(ctx);
+				if (err) { fprintf(stderr, "compression failed: %d\n", err); return 1; }
+
+				qsort(lat, calls, sizeof(uint64_t), cmp_u64);
+				printf("%s,%zu,%s,%zu,%llu,%llu,%llu,%llu,%.1f,%.3f,%.1f,%.1f,%.1f,%.4f\n", corpus_names[types[ti]], len, mode_names[mode], calls,
+					(unsigned long long)lat[calls / 2], (unsigned long long)lat[calls * 99 / 100], (unsigned long long)lat[calls * 999 / 1000], (unsigned long long)lat[calls - 1],
+					(double)total / calls, (double)lat_allocs / calls, (double)lat_alloc_bytes / calls,
+					n_misses < 0 ? -1.0 : (double)n_misses / calls, n_tlb < 0 ? -1.0 : (double)n_tlb / calls, (double)total_out / ((double)len * calls));
+				fflush(stdout);
+			}
+		}
+	}
+
+	free(in); free(out); free(dict_data); free(lat);
+	return 0;
+}
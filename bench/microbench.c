@@ -0,0 +1,319 @@
+// ms-compress: implements Microsoft compression algorithms
+// Copyright (C) 2018 David Mulder <dmulder@suse.com>
+//
+// This library is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This library is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+
+////////////////////////////// Per-Stage Microbenchmarks ///////////////////////////////////////////
+// Times the individual compression stages on controlled inputs so that a regression (or a gain)
+// can be attributed to a single kernel instead of the whole codec. Prints one CSV row per case.
+//
+// Build (from the repository root):
+//   make xh_microbench
+//
+// Usage:
+//   xh_microbench [--stages find,match,fill,codes,codes_slow,bits,encode,histogram] [--min-time 0.2]
+//
+// Columns:
+//   stage, case             the kernel and the input it was run on
+//   calls                   number of calls timed
+//   ns_per_call             wall-clock nanoseconds per call
+//   ns_per_byte             nanoseconds per input byte (0 when the kernel does not process bytes)
+//   cycles_per_call         reference cycles per call (0 if unavailable)
+//   detail                  case specific: average match length / chain depth / code length / ...
+
+#include <stdio.h>
+#include <getopt.h>
+
+#include "../src/xpress_huff_internal.h"
+#include "../src/Bitstream.h"
+#include "corpus.h"
+
+#define MB_BUF_LEN		(CHUNK_SIZE * 2)
+
+typedef enum { STAGE_FIND, STAGE_MATCH, STAGE_FILL, STAGE_CODES, STAGE_CODES_SLOW, STAGE_BITS, STAGE_ENCODE, STAGE_HISTOGRAM, STAGE_COUNT } mb_stage;
+static const char* const stage_names[STAGE_COUNT] = { "find", "match", "fill", "codes", "codes_slow", "bits", "encode", "histogram" };
+
+static double min_time = 0.2;
+static volatile uint64_t sink; // keeps the compiler from dropping the work being timed
+
+typedef struct
+{
+	uint64_t calls, ns, cycles;
+} mb_timing;
+
+// Repeatedly calls fn(arg) (each call performs calls_per_run kernel calls) until min_time has passed
+#define MB_TIME(t, calls_per_run, body)                                      \
+{                                                                            \
+	uint64_t _runs = 0;                                                      \
+	const uint64_t _start = bench_now_ns(), _start_cycles = bench_cycles();  \
+	do { body; ++_runs; } while (bench_now_ns() - _start < min_time * 1e9);  \
+	(t).cycles = bench_cycles() - _start_cycles;                             \
+	(t).ns = bench_now_ns() - _start;                                        \
+	(t).calls = _runs * (calls_per_run);                                     \
+}
+
+static void mb_report(const char* stage, const char* name, const mb_timing* t, size_t bytes_per_call, double detail)
+{
+	printf("%s,%s,%llu,%.2f,%.4f,%.1f,%.3f\n", stage, name, (unsigned long long)t->calls, (double)t->ns / t->calls,
+		bytes_per_call ? (double)t->ns / t->calls / bytes_per_call : 0.0, (double)t->cycles / t->calls, detail);
+	fflush(stdout);
+}
+
+// Builds a buffer with a controlled match length distribution and chain length:
+//   the bytes are drawn from an alphabet of `alphabet` symbols (smaller alphabets give longer hash
+//   chains with short matches) and every so often `match_len` bytes are copied from a random earlier
+//   position within the window (0 for no explicit copies).
+static void mb_gen_matches(uint8_t* buf, size_t len, uint32_t alphabet, uint32_t match_len, uint64_t seed)
+{
+	bench_rng r;
+	bench_rng_seed(&r, seed);
+	size_t pos = 0;
+	while (pos < len)
+	{
+		if (match_len && pos > match_len + 16 && bench_rng_below(&r, 2))
+		{
+			const size_t back = 1 + match_len + bench_rng_below(&r, (uint32_t)MIN(pos - match_len, MAX_OFFSET - match_len));
+			for (size_t i = 0; i < match_len && pos < len; ++i, ++pos) { buf[pos] = buf[pos - back]; }
+		}
+		for (uint32_t i = 0; i < 4 && pos < len; ++i) { buf[pos++] = (uint8_t)bench_rng_below(&r, alphabet); }
+	}
+}
+
+static void mb_find(void)
+{
+	static const struct { const char* name; uint32_t alphabet, match_len; } cases[] = {
+		{ "random", 256, 0 }, { "alphabet16", 16, 0 }, { "alphabet4", 4, 0 },
+		{ "match8", 256, 8 }, { "match32", 256, 32 }, { "match128", 256, 128 }, { "match1024", 256, 1024 },
+	};
+	uint8_t* buf = (uint8_t*)malloc(MB_BUF_LEN);
+	for (size_t c = 0; c < sizeof(cases)/sizeof(cases[0]); ++c)
+	{
+		XpressDictionary d;
+		mb_timing t;
+		mb_gen_matches(buf, MB_BUF_LEN, cases[c].alphabet, cases[c].match_len, 1 + c);
+		XpressDictionary_init(&d, buf, buf + MB_BUF_LEN);
+		Fill(&d, buf);
+		Fill(&d, buf + CHUNK_SIZE);
+
+		// Average chain depth that Find will walk (capped at MAX_CHAIN), computed outside of the timing
+		uint64_t depth = 0;
+		for (const uint8_t* data = buf + CHUNK_SIZE; data < buf + MB_BUF_LEN - 4; ++data)
+		{
+			uint32_t n = 0;
+			const uint32_t xend = XpressDictionary_pos(&d, data) - MAX_OFFSET;
+			for (uint32_t x = d.window[WindowPos(&d, data)]; n < MAX_CHAIN && x >= xend; x = d.window[x & d.WindowMask]) { ++n; }
+			depth += n;
+		}
+
+		// Find at every position of the second chunk (not skipping over the matches found)
+		uint64_t total_len = 0;
+		MB_TIME(t, CHUNK_SIZE - 4,
+			for (const uint8_t* data = buf + CHUNK_SIZE; data < buf + MB_BUF_LEN - 4; ++data) { uint32_t off; total_len += Find(&d, data, &off); });
+		sink += total_len;
+		char name[64];
+		snprintf(name, sizeof(name), "%s_depth%.1f", cases[c].name, (double)depth / (CHUNK_SIZE - 4));
+		mb_report("find", name, &t, 0, (double)total_len / t.calls);
+		XpressDictionary_free(&d);
+	}
+	free(buf);
+}
+
+static void mb_match(void)
+{
+	static const uint32_t lens[] = { 3, 8, 16, 48, 258, 4096 };
+	uint8_t* a = (uint8_t*)malloc(0x2000), *b = (uint8_t*)malloc(0x2000);
+	corpus_random(a, 0x2000, 7);
+	for (size_t c = 0; c < sizeof(lens)/sizeof(lens[0]); ++c)
+	{
+		mb_timing t;
+		char name[32];
+		memcpy(b, a, 0x2000);
+		b[lens[c]] = ~a[lens[c]];
+		uint64_t total = 0;
+#ifdef MSCOMP_WITH_UNALIGNED_ACCESS
+		MB_TIME(t, 256, for (int i = 0; i < 256; ++i) { total += GetMatchLength(a, b, b + 0x2000, b + 0x2000 - 4); });
+#else
+		MB_TIME(t, 256, for (int i = 0; i < 256; ++i) { total += GetMatchLength(a, b, b + 0x2000); });
+#endif
+		sink += total;
+		snprintf(name, sizeof(name), "len%u", lens[c]);
+		mb_report("match", name, &t, lens[c], (double)total / t.calls);
+	}
+	free(a); free(b);
+}
+
+static void mb_fill(void)
+{
+	static const corpus_type types[] = { CORPUS_TEXT, CORPUS_RANDOM, CORPUS_VM };
+	uint8_t* buf = (uint8_t*)malloc(MB_BUF_LEN);
+	for (size_t c = 0; c < sizeof(types)/sizeof(types[0]); ++c)
+	{
+		XpressDictionary d;
+		mb_timing t;
+		corpus_generate(types[c], buf, MB_BUF_LEN, 3);
+		XpressDictionary_init(&d, buf, buf + MB_BUF_LEN);
+		MB_TIME(t, 1, sink += (uintptr_t)Fill(&d, buf));
+		mb_report("fill", corpus_names[types[c]], &t, CHUNK_SIZE, 0);
+		XpressDictionary_free(&d);
+	}
+	free(buf);
+}
+
+// Symbol count distributions for the Huffman code builders:
+//   uniform    all 512 symbols equally likely (flat codes)
+//   text       literal-heavy, roughly Zipfian counts like a text chunk
+//   sparse     only 40 symbols used
+//   skewed     counts fall off geometrically so that unlimited codes would be far longer than 15 bits
+static void mb_gen_counts(uint32_t counts[SYMBOLS], int kind)
+{
+	bench_rng r;
+	bench_rng_seed(&r, 11 + kind);
+	for (uint_fast16_t i = 0; i < SYMBOLS; ++i)
+	{
+		switch (kind)
+		{
+		case 0: counts[i] = 128; break;
+		case 1: counts[i] = (i < 0x100 ? 60000 : 6000) / (1 + bench_rng_below(&r, 200)); break;
+		case 2: counts[i] = (bench_rng_below(&r, SYMBOLS) < 40) ? 1 + bench_rng_below(&r, 4000) : 0; break;
+		default: counts[i] = (i < 24) ? (1u << (24 - i)) : (i & 1); break;
+		}
+	}
+	counts[STREAM_END] = MAX(counts[STREAM_END], 1);
+}
+static const char* const count_names[] = { "uniform", "text", "sparse", "skewed" };
+
+static void mb_codes(int slow)
+{
+	HuffmanEncoder encoder;
+	uint32_t counts[SYMBOLS];
+	for (int c = 0; c < 4; ++c)
+	{
+		mb_timing t;
+		mb_gen_counts(counts, c);
+		if (slow) { MB_TIME(t, 1, sink += CreateCodesSlow(&encoder, counts)[0]); }
+		else      { MB_TIME(t, 1, sink += CreateCodes(&encoder, counts)[0]); }
+		uint_fast8_t max = 0;
+		for (uint_fast16_t i = 0; i < SYMBOLS; ++i) { max = MAX(max, encoder.lens[i]); }
+		mb_report(slow ? "codes_slow" : "codes", count_names[c], &t, 0, max);
+	}
+}
+
+static void mb_bits(void)
+{
+	static const uint8_t max_lens[] = { 4, 9, 15 };
+	const size_t n = 0x10000;
+	uint32_t* vals = (uint32_t*)malloc(n * sizeof(uint32_t));
+	uint8_t* lens = (uint8_t*)malloc(n), *out = (uint8_t*)malloc(n * 2 + 8);
+	bench_rng r;
+	bench_rng_seed(&r, 5);
+	for (size_t c = 0; c < sizeof(max_lens)/sizeof(max_lens[0]); ++c)
+	{
+		mb_timing t;
+		char name[32];
+		uint64_t bits = 0;
+		for (size_t i = 0; i < n; ++i) { lens[i] = (uint8_t)(1 + bench_rng_below(&r, max_lens[c])); vals[i] = bench_rng_next(&r) & ((1u << lens[i]) - 1); bits += lens[i]; }
+		MB_TIME(t, n,
+		{
+			OutputBitstream bstr;
+			OutputBitstream_init(&bstr, out);
+			for (size_t i = 0; i < n; ++i) { WriteBits(&bstr, vals[i], lens[i]); }
+			Finish(&bstr);
+			sink += out[0];
+		});
+		snprintf(name, sizeof(name), "len1-%u", max_lens[c]);
+		mb_report("bits", name, &t, 0, (double)bits / n);
+	}
+	free(vals); free(lens); free(out);
+}
+
+static void mb_encode(void)
+{
+	static const corpus_type types[] = { CORPUS_TEXT, CORPUS_RECORDS, CORPUS_VM, CORPUS_RANDOM };
+	uint8_t* in = (uint8_t*)malloc(CHUNK_SIZE), *buf = (uint8_t*)malloc(0x1200C), *out = (uint8_t*)malloc(CHUNK_SIZE * 2);
+	uint32_t counts[SYMBOLS];
+	HuffmanEncoder encoder;
+	for (size_t c = 0; c < sizeof(types)/sizeof(types[0]); ++c)
+	{
+		XpressDictionary d;
+		mb_timing t;
+		corpus_generate(types[c], in, CHUNK_SIZE, 9);
+		XpressDictionary_init(&d, in, in + CHUNK_SIZE);
+		const size_t buf_len = xh_compress_lz77(in, CHUNK_SIZE, 1, buf, counts, &d);
+		const uint8_t* lens = CreateCodes(&encoder, counts);
+		const size_t comp_len = xh_calc_compressed_len(lens, counts, buf_len);
+		MB_TIME(t, 1, { xh_compress_encode(buf, buf + buf_len, out, &encoder); sink += out[0]; });
+		mb_report("encode", corpus_names[types[c]], &t, CHUNK_SIZE, (double)comp_len);
+		XpressDictionary_free(&d);
+	}
+	free(in); free(buf); free(out);
+}
+
+static void mb_histogram(void)
+{
+	static const corpus_type types[] = { CORPUS_TEXT, CORPUS_RANDOM, CORPUS_VM };
+	uint8_t* in = (uint8_t*)malloc(CHUNK_SIZE), *buf = (uint8_t*)malloc(0x1200C);
+	uint32_t counts[SYMBOLS];
+	for (size_t c = 0; c < sizeof(types)/sizeof(types[0]); ++c)
+	{
+		mb_timing t;
+		corpus_generate(types[c], in, CHUNK_SIZE, 13);
+		MB_TIME(t, 1, sink += xh_compress_no_matching(in, CHUNK_SIZE, 0, buf, counts));
+		mb_report("histogram", corpus_names[types[c]], &t, CHUNK_SIZE, 0);
+	}
+	free(in); free(buf);
+}
+
+int main(int argc, char* argv[])
+{
+	int run[STAGE_COUNT];
+	for (int i = 0; i < STAGE_COUNT; ++i) { run[i] = 1; }
+
+	static const struct option opts[] = {
+		{ "stages",   required_argument, NULL, 's' },
+		{ "min-time", required_argument, NULL, 'T' },
+		{ NULL, 0, NULL, 0 }
+	};
+	for (int c; (c = getopt_long(argc, argv, "s:T:", opts, NULL)) != -1; )
+	{
+		switch (c)
+		{
+		case 's':
+			memset(run, 0, sizeof(run));
+			for (char* name = strtok(optarg, ","); name; name = strtok(NULL, ","))
+			{
+				int i = 0;
+				while (i < STAGE_COUNT && strcmp(name, stage_names[i]) != 0) { ++i; }
+				if (i == STAGE_COUNT) { fprintf(stderr, "unknown stage: %s\n", name); return 1; }
+				run[i] = 1;
+			}
+			break;
+		case 'T': min_time = atof(optarg); break;
+		default:
+			fprintf(stderr, "usage: %s [--stages list] [--min-time sec]\n", argv[0]);
+			return 1;
+		}
+	}
+
+	printf("stage,case,calls,ns_per_call,ns_per_byte,cycles_per_call,detail\n");
+	if (run[STAGE_FIND])       { mb_find(); }
+	if (run[STAGE_MATCH])      { mb_match(); }
+	if (run[STAGE_FILL])       { mb_fill(); }
+	if (run[STAGE_CODES])      { mb_codes(0); }
+	if (run[STAGE_CODES_SLOW]) { mb_codes(1); }
+	if (run[STAGE_BITS])       { mb_bits(); }
+	if (run[STAGE_ENCODE])     { mb_encode(); }
+	if (run[STAGE_HISTOGRAM])  { mb_histogram(); }
+	return 0;
+}
@@ -30,6 +30,14 @@ typedef struct
 {
 	uint16_t codes[SYMBOLS];
 	uint8_t lens[SYMBOLS];
+
+	// Scratch space for building the codes so that they need almost no stack. The node numbers of
+	// CreateCodes fit in 16 bits (there are 2*SYMBOLS nodes).
+	uint32_t weights[SYMBOLS * 2]; // weights of nodes, 4 kb
+	uint16_t heap[SYMBOLS + 2];    // heap of symbols, 1 kb
+	uint16_t parents[SYMBOLS * 2]; // parents of nodes, 2 kb
+	uint16_t syms_by_count[SYMBOLS], syms_by_len[SYMBOLS], temp[SYMBOLS]; // CreateCodesSlow, 3 kb
+	uint8_t leaves[HUFF_BITS_MAX][SYMBOLS/4]; // CreateCodesSlow, a bit for each item merged at each level, 2 kb
 } HuffmanEncoder;
 
 #define HEAP_PUSH(x)                         \
@@ -58,7 +66,7 @@ typedef struct
 	heap[i] = t;                                    \
 }
 
-const uint8_t* CreateCodes(HuffmanEncoder *ctx, uint32_t symbol_counts[SYMBOLS]) // 17 kb stack (for SYMBOLS == 0x200)
+static inline const uint8_t* CreateCodes(HuffmanEncoder *ctx, uint32_t symbol_counts[SYMBOLS])
 {
 	// Creates Length-Limited Huffman Codes using an optimized version of the original Huffman algorithm
 	// Does not always produce optimal codes
@@ -67,19 +75,22 @@ const uint8_t* CreateCodes(HuffmanEncoder *ctx, uint32_t symbol_counts[SYMBOLS])
 	memset(ctx->codes, 0, sizeof(ctx->codes));
 
 	// Compute the initial weights (the weight is in the upper 24 bits, the depth (initially 0) is in the lower 8 bits
-	uint32_t weights[SYMBOLS * 2]; // weights of nodes
+	uint32_t* const weights = ctx->weights;
 	weights[0] = 0;
 	for (uint_fast16_t i = 0; i < SYMBOLS; ++i) { weights[i+1] = (symbol_counts[i] == 0 ? 1 : symbol_counts[i]) << 8; }
 
 	for (;;)
 	{
 		// Build the initial heap
-		uint_fast16_t heap_len = 0, heap[SYMBOLS + 2] = { 0 }; // heap of symbols, 1 to heap_len
+		uint16_t* const heap = ctx->heap; // 1 to heap_len
+		uint_fast16_t heap_len = 0;
+		heap[0] = 0;
 		for (uint_fast16_t i = 1; i <= SYMBOLS; ++i) { HEAP_PUSH(i); }
 
 		// Build the tree (its a bottom-up tree)
-		uint_fast16_t n_nodes = SYMBOLS, parents[SYMBOLS * 2]; // parents of nodes, 1 to n_nodes
-		memset(parents, 0, sizeof(parents));
+		uint16_t* const parents = ctx->parents; // 1 to n_nodes
+		uint_fast16_t n_nodes = SYMBOLS;
+		memset(parents, 0, sizeof(ctx->parents));
 		while (heap_len > 1)
 		{
 			uint_fast16_t n1 = heap[1]; HEAP_POP();
@@ -129,7 +140,30 @@ const uint8_t* CreateCodes(HuffmanEncoder *ctx, uint32_t symbol_counts[SYMBOLS])
 	return ctx->lens;
 }
 
-const uint8_t* CreateCodesSlow(HuffmanEncoder *ctx, uint32_t symbol_counts[SYMBOLS]) // 3 kb stack (for SYMBOLS == 0x200) [519kb stack when compiled with MSCOMP_WITH_LARGE_STACK]
+// The number of leaves (symbols instead of packages) in the first n items merged at a level of CreateCodesSlow
+static inline uint_fast16_t CountLeaves(const uint8_t* leaves, uint_fast16_t n)
+{
+	uint_fast16_t count = 0;
+	for (uint_fast16_t i = 0; i < n; ++i) { count += (leaves[i >> 3] >> (i & 7)) & 1; }
+	return count;
+}
+
+// Removes a bit from the length of every symbol in the items a to b-1 merged at level j of
+// CreateCodesSlow. The leaves and the packages of a level are each merged in order, so the packages
+// among the items are a run of packages of the level before, which are made of a run of its items.
+static inline void DropItems(HuffmanEncoder *ctx, uint_fast16_t j, uint_fast16_t a, uint_fast16_t b)
+{
+	for (;;)
+	{
+		const uint_fast16_t leaves_a = CountLeaves(ctx->leaves[j], a), leaves_b = CountLeaves(ctx->leaves[j], b);
+		for (uint_fast16_t i = leaves_a; i < leaves_b; ++i) { --ctx->lens[ctx->syms_by_count[i]]; }
+		a = (a - leaves_a) << 1; b = (b - leaves_b) << 1;
+		if (a == b) { break; }
+		--j;
+	}
+}
+
+static inline const uint8_t* CreateCodesSlow(HuffmanEncoder *ctx, uint32_t symbol_counts[SYMBOLS])
 {
 	// Creates Length-Limited Huffman Codes using the package-merge algorithm
 	// Always produces optimal codes but is significantly slower than the Huffman algorithm
@@ -137,7 +171,7 @@ const uint8_t* CreateCodesSlow(HuffmanEncoder *ctx, uint32_t symbol_counts[SYMBO
 	memset(ctx->lens,  0, sizeof(ctx->lens));
 
 	// Fill the syms_by_count and syms_by_length with the symbols that were found
-	uint16_t syms_by_count[SYMBOLS], syms_by_len[SYMBOLS], temp[SYMBOLS]; // 3*2*512 = 3 kb
+	uint16_t* const syms_by_count = ctx->syms_by_count, * const syms_by_len = ctx->syms_by_len, * const temp = ctx->temp;
 	uint_fast16_t len = 0;
 	for (uint_fast16_t i = 0; i < SYMBOLS; ++i) { if (symbol_counts[i]) { syms_by_count[len] = (uint16_t)i; syms_by_len[len++] = (uint16_t)i; ctx->lens[i] = HUFF_BITS_MAX; } }
 
@@ -150,47 +184,34 @@ const uint8_t* CreateCodesSlow(HuffmanEncoder *ctx, uint32_t symbol_counts[SYMBO
 	else
 	{
 		///// Package-Merge Algorithm /////
-		typedef struct _collection // 516 bytes each
-		{
-			uint8_t symbols[SYMBOLS];
-			uint_fast16_t count;
-		} collection;
-#ifdef MSCOMP_WITH_LARGE_STACK
-		collection _cols[SYMBOLS], _next_cols[SYMBOLS],
-#else
-		collection *_cols = (collection*)malloc(SYMBOLS*sizeof(collection)),
-			*_next_cols = (collection*)malloc(SYMBOLS*sizeof(collection)),
-#endif
-			*cols = _cols, *next_cols = _next_cols; // 2*516*512 = 516 kb (not on stack any more)
+		// Only the counts of the packages are kept (in weights) along with which of the items merged at
+		// each level were leaves, the symbols of a package are found from those when it gets dropped
+		uint32_t *cols = ctx->weights, *next_cols = ctx->weights + SYMBOLS;
 		uint_fast16_t cols_len = 0, next_cols_len = 0;
 
 		// Start at the lowest value row, adding new collection
 		for (uint_fast16_t j = 0; j < HUFF_BITS_MAX; ++j)
 		{
-			uint_fast16_t cols_pos = 0, pos = 0;
+			uint8_t* const leaves = ctx->leaves[j];
+			uint_fast16_t cols_pos = 0, pos = 0, n = 0;
+			memset(leaves, 0, sizeof(ctx->leaves[j]));
 
 			// All but the last one/none get added to collections
 			while ((cols_len-cols_pos + len-pos) > 1)
 			{
-				memset(next_cols+next_cols_len, 0, sizeof(collection));
-				for (uint_fast16_t i = 0; i < 2; ++i) // hopefully unrolled...
+				next_cols[next_cols_len] = 0;
+				for (uint_fast16_t i = 0; i < 2; ++i, ++n) // hopefully unrolled...
 				{
-					if (pos >= len || (cols_pos < cols_len && cols[cols_pos].count < symbol_counts[syms_by_count[pos]]))
+					if (pos >= len || (cols_pos < cols_len && cols[cols_pos] < symbol_counts[syms_by_count[pos]]))
 					{
 						// Add cols[cols_pos]
-						next_cols[next_cols_len].count += cols[cols_pos].count;
-						for (uint_fast16_t s = 0; s < SYMBOLS; ++s)
-						{
-							next_cols[next_cols_len].symbols[s] += cols[cols_pos].symbols[s];
-						}
-						++cols_pos;
+						next_cols[next_cols_len] += cols[cols_pos++];
 					}
 					else
 					{
 						// Add syms[pos]
-						next_cols[next_cols_len].count += symbol_counts[syms_by_count[pos]];
-						++next_cols[next_cols_len].symbols[syms_by_count[pos]];
-						++pos;
+						next_cols[next_cols_len] += symbol_counts[syms_by_count[pos++]];
+						leaves[n >> 3] |= 1 << (n & 7);
 					}
 				}
 				++next_cols_len;
@@ -199,8 +220,7 @@ const uint8_t* CreateCodesSlow(HuffmanEncoder *ctx, uint32_t symbol_counts[SYMBO
 			// Leftover gets dropped
 			if (cols_pos < cols_len)
 			{
-				const uint8_t* const syms = cols[cols_pos].symbols;
-				for (uint_fast16_t i = 0; i < SYMBOLS; ++i) { ctx->lens[i] -= syms[i]; }
+				DropItems(ctx, j - 1, cols_pos << 1, (cols_pos + 1) << 1);
 			}
 			else if (pos < len)
 			{
@@ -208,13 +228,10 @@ const uint8_t* CreateCodesSlow(HuffmanEncoder *ctx, uint32_t symbol_counts[SYMBO
 			}
 
 			// Move the next_collections to the current collections
-			collection* temp_cols = cols; cols = next_cols; next_cols = temp_cols;
+			uint32_t* temp_cols = cols; cols = next_cols; next_cols = temp_cols;
 			cols_len = next_cols_len;
 			next_cols_len = 0;
 		}
-#ifndef MSCOMP_WITH_LARGE_STACK
-		free(_cols); free(_next_cols);
-#endif
 
 		////////// Create Huffman codes from lengths //////////
 		merge_sort_uint8_t(syms_by_len, temp, ctx->lens, len); // Sort by the code lengths
@@ -228,7 +245,7 @@ const uint8_t* CreateCodesSlow(HuffmanEncoder *ctx, uint32_t symbol_counts[SYMBO
 	return ctx->lens;
 }
 
-void EncodeSymbol(HuffmanEncoder *ctx, uint_fast16_t sym, OutputBitstream *bits)
+static inline void EncodeSymbol(HuffmanEncoder *ctx, uint_fast16_t sym, OutputBitstream *bits)
 {
 	WriteBits(bits, ctx->codes[sym], ctx->lens[sym]);
 }
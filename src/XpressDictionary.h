@@ -24,63 +24,204 @@
 #ifndef MSCOMP_XPRESS_DICTIONARY_H
 #define MSCOMP_XPRESS_DICTIONARY_H
 
+#include <errno.h>
 #include <stdlib.h>
 #include <string.h>
 #include <stdarg.h>
+#include "mscomp_allocator.h"
 
 #define MAX_OFFSET              0xFFFF
 #define CHUNK_SIZE              0x10000
-#define HASH_BITS		15
+#define HASH_BITS		15 // the defaults, see XpressDictionary_alloc and MaxChain / NiceLength
+#define MIN_HASH_BITS		10
+#define MAX_HASH_BITS		16
 #define MAX_CHAIN		11
 #define NICE_LENGTH		48
 
+// The table and window hold positions instead of pointers so that they are half the size on 64-bit
+// and do not depend on where the data is (see XpressDictionary_pos). Positions are stored with a bias
+// of POS_BIAS so that an empty entry (0) is always more than MAX_OFFSET before any position. The start
+// has to be moved forward (see XpressDictionary_reset) before positions reach MAX_POS.
+#define POS_BIAS		CHUNK_SIZE
+#define MAX_POS			0x80000000u
+
 typedef struct
 {
 	// Window properties
 	uint32_t WindowSize;
 	uint32_t WindowMask;
+	uint32_t WindowCap; // number of entries allocated, at least WindowSize
 
 	// The hashing function, which works progressively
 	uint32_t HashSize;
 	uint32_t HashMask;
 	unsigned HashShift;
 
+	// Limits of Find: the number of chain entries to look at, the length to stop looking at and the
+	// largest offset the format can encode (at most MAX_OFFSET)
+	uint32_t MaxChain;
+	uint32_t NiceLength;
+	uint32_t MaxOffset;
+
+	// Adaptive chain depth (see XpressDictionary_adapt): when Adaptive is set Find walks ChainLimit
+	// entries instead of MaxChain, MissRun counts the Finds in a row that found nothing
+	int Adaptive;
+	uint32_t ChainLimit, MissRun;
+
+	// Cost-aware Find (see XpressDictionary_score): the bits of each of the 512 Xpress Huffman symbols
+	// (NULL to keep the longest match) and the average bits of a literal in 1/16 bits
+	const uint8_t* Costs;
+	uint32_t LiteralCost;
+
 	const uint8_t *start, *end, *end2;
-	const uint8_t** table;
-	const uint8_t** window;
+	uint32_t* table;
+	uint32_t* window;
+	const mscomp_allocator* allocator; // for table and window, NULL for malloc
+	int External; // table and window are in memory given to XpressDictionary_place
+
+	// Statistics of Find, reset with the data and after each chunk they are read into xpress_huff_stats
+	uint32_t FindCount, ChainSteps, NiceHits;
 } XpressDictionary;
 
-void XpressDictionary_init(XpressDictionary *ctx, const const uint8_t* start, const const uint8_t* end)
+// The number of window entries needed for in_len bytes: two chunks (the one being compressed and the
+// one filled ahead of it) or the whole input if it is smaller
+static inline uint32_t XpressDictionary_window_size(size_t in_len)
+{
+	uint32_t size = 1;
+	while (size < in_len && size < (CHUNK_SIZE << 1)) { size <<= 1; }
+	return size;
+}
+
+// The number of bytes XpressDictionary_alloc allocates
+static inline size_t XpressDictionary_memory(unsigned hash_bits, size_t in_len)
+{
+	return (((size_t)1 << hash_bits) + XpressDictionary_window_size(in_len)) * sizeof(uint32_t);
+}
+
+// Sets up a dictionary without any tables, they are allocated by XpressDictionary_alloc from allocator
+static inline void XpressDictionary_empty(XpressDictionary *ctx, const mscomp_allocator* allocator)
+{
+	ctx->WindowSize = ctx->WindowMask = ctx->WindowCap = 0;
+	ctx->HashSize = ctx->HashMask = 0;
+	ctx->HashShift = 0;
+	ctx->MaxChain = MAX_CHAIN;
+	ctx->NiceLength = NICE_LENGTH;
+	ctx->MaxOffset = MAX_OFFSET;
+	ctx->Adaptive = 0;
+	ctx->ChainLimit = MAX_CHAIN;
+	ctx->MissRun = 0;
+	ctx->Costs = NULL;
+	ctx->LiteralCost = 0;
+	ctx->table = NULL;
+	ctx->window = NULL;
+	ctx->allocator = allocator;
+	ctx->External = 0;
+}
+
+static inline void XpressDictionary_free(XpressDictionary *ctx)
+{
+	if (!ctx->External)
+	{
+		mscomp_free(ctx->allocator, (void*)ctx->table);
+		mscomp_free(ctx->allocator, (void*)ctx->window);
+	}
+	ctx->table = NULL;
+	ctx->window = NULL;
+	ctx->HashSize = ctx->WindowCap = 0;
+	ctx->External = 0;
+}
+
+static inline void XpressDictionary_set_hash(XpressDictionary *ctx, unsigned hash_bits)
 {
-	ctx->WindowSize = CHUNK_SIZE << 1;
-	ctx->WindowMask = ctx->WindowSize-1;
-	ctx->HashSize = 1 << HASH_BITS;
+	ctx->HashSize = 1 << hash_bits;
 	ctx->HashMask = ctx->HashSize - 1;
-	ctx->HashShift = (HASH_BITS+2)/3;
-	ctx->table = (const uint8_t**)malloc(ctx->HashSize*sizeof(const uint8_t*));
-	ctx->window = (const uint8_t**)malloc(ctx->WindowSize*sizeof(const uint8_t*));
+	ctx->HashShift = (hash_bits+2)/3;
+}
+
+// Makes the tables the right size for a hash of hash_bits (MIN_HASH_BITS to MAX_HASH_BITS) and in_len
+// bytes of input. The window is only reallocated if it is too small.
+static inline int XpressDictionary_alloc(XpressDictionary *ctx, unsigned hash_bits, size_t in_len)
+{
+	const uint32_t hash_size = 1 << hash_bits, window_size = XpressDictionary_window_size(in_len);
+	if (ctx->External) { XpressDictionary_free(ctx); }
+	if (ctx->HashSize != hash_size)
+	{
+		mscomp_free(ctx->allocator, (void*)ctx->table);
+		ctx->HashSize = 0;
+		if ((ctx->table = (uint32_t*)mscomp_alloc(ctx->allocator, hash_size*sizeof(uint32_t))) == NULL) { return ENOMEM; }
+		XpressDictionary_set_hash(ctx, hash_bits);
+	}
+	if (ctx->WindowCap < window_size)
+	{
+		mscomp_free(ctx->allocator, (void*)ctx->window);
+		ctx->WindowCap = 0;
+		if ((ctx->window = (uint32_t*)mscomp_alloc(ctx->allocator, window_size*sizeof(uint32_t))) == NULL) { return ENOMEM; }
+		ctx->WindowCap = window_size;
+	}
+	ctx->WindowSize = window_size;
+	ctx->WindowMask = window_size - 1;
+	return 0;
+}
+
+// Like XpressDictionary_alloc but puts the tables at the start of mem (which must have at least
+// XpressDictionary_memory bytes and stay valid while the dictionary is used) instead of allocating them
+static inline void XpressDictionary_place(XpressDictionary *ctx, unsigned hash_bits, size_t in_len, void* mem)
+{
+	if (!ctx->External) { XpressDictionary_free(ctx); }
+	XpressDictionary_set_hash(ctx, hash_bits);
+	ctx->WindowSize = ctx->WindowCap = XpressDictionary_window_size(in_len);
+	ctx->WindowMask = ctx->WindowSize - 1;
+	ctx->table = (uint32_t*)mem;
+	ctx->window = ctx->table + ctx->HashSize;
+	ctx->External = 1;
+}
 
+// Sets the data the dictionary works on without emptying the table
+static inline void XpressDictionary_set_data(XpressDictionary *ctx, const const uint8_t* start, const const uint8_t* end)
+{
 	ctx->start = start;
 	ctx->end = end;
 	ctx->end2 = end - 2;
-	memset(ctx->table, 0, ctx->HashSize*sizeof(const uint8_t*));
+	ctx->FindCount = 0;
+	ctx->ChainSteps = 0;
+	ctx->NiceHits = 0;
+}
+
+static inline void XpressDictionary_reset(XpressDictionary *ctx, const const uint8_t* start, const const uint8_t* end)
+{
+	XpressDictionary_set_data(ctx, start, end);
+	memset(ctx->table, 0, ctx->HashSize*sizeof(uint32_t));
 }
 
-uint32_t WindowPos(XpressDictionary *ctx, const uint8_t* x) 
+// Allocates a dictionary with the default settings for start to end
+static inline int XpressDictionary_init(XpressDictionary *ctx, const const uint8_t* start, const const uint8_t* end)
 {
-	return (uint32_t)((x - ctx->start) & ctx->WindowMask);
+	XpressDictionary_empty(ctx, NULL);
+	if (XpressDictionary_alloc(ctx, HASH_BITS, end - start) != 0) { XpressDictionary_free(ctx); return ENOMEM; }
+	XpressDictionary_reset(ctx, start, end);
+	return 0;
 }
 
-uint_fast16_t HashUpdate(XpressDictionary *ctx, const uint_fast16_t h, const uint8_t c)
+static inline uint32_t XpressDictionary_pos(XpressDictionary *ctx, const uint8_t* x)
+{
+	return (uint32_t)(x - ctx->start) + POS_BIAS;
+}
+
+static inline uint32_t WindowPos(XpressDictionary *ctx, const uint8_t* x) 
+{
+	return XpressDictionary_pos(ctx, x) & ctx->WindowMask;
+}
+
+static inline uint_fast16_t HashUpdate(XpressDictionary *ctx, const uint_fast16_t h, const uint8_t c)
 {
 	return ((h<<ctx->HashShift) ^ c) & ctx->HashMask;
 }
 
 
 #ifdef MSCOMP_WITH_UNALIGNED_ACCESS
-static uint32_t GetMatchLength(const uint8_t* a, const uint8_t* b, const const uint8_t* end, const const uint8_t* end4)
+static inline uint32_t GetMatchLength(const uint8_t* a, const uint8_t* b, const const uint8_t* end, const const uint8_t* end4)
 #else
-static uint32_t GetMatchLength(const uint8_t* a, const uint8_t* b, const const uint8_t* end)
+static inline uint32_t GetMatchLength(const uint8_t* a, const uint8_t* b, const const uint8_t* end)
 #endif
 {
 	// like memcmp but tells you the length of the match and optimized
@@ -102,50 +243,52 @@ static uint32_t GetMatchLength(const uint8_t* a, const uint8_t* b, const const u
 	return (uint32_t)(b - b_start - 1);
 }
 
-const uint8_t* Fill(XpressDictionary *ctx, const uint8_t* data)
+static inline const uint8_t* Fill(XpressDictionary *ctx, const uint8_t* data)
 {
 	// equivalent to Add(data, CHUNK_SIZE)
 	if (data >= ctx->end2) { return ctx->end2; }
-	uint32_t pos = WindowPos(ctx, data); // either 0x00000 or CHUNK_SIZE
+	uint32_t pos = WindowPos(ctx, data); // either 0x00000 or CHUNK_SIZE (always 0 when the window is smaller)
+	uint32_t p = XpressDictionary_pos(ctx, data);
 	const const uint8_t* endx = ((data + CHUNK_SIZE) < ctx->end2) ? data + CHUNK_SIZE : ctx->end2;
 	uint_fast16_t hash = HashUpdate(ctx, data[0], data[1]);
 	while (data < endx)
 	{
 		hash = HashUpdate(ctx, hash, data[2]);
 		ctx->window[pos++] = ctx->table[hash];
-		ctx->table[hash] = data++;
+		ctx->table[hash] = p++;
+		++data;
 	}
 	return endx;
 }
 
-static void Add1(XpressDictionary *ctx, const uint8_t* data)
+static inline void Add1(XpressDictionary *ctx, const uint8_t* data)
 {
 	if (data < ctx->end2)
 	{
 		// TODO: could make ctx more efficient by keeping track of the last hash
 		uint_fast16_t hash = HashUpdate(ctx, HashUpdate(ctx, data[0], data[1]), data[2]);
 		ctx->window[WindowPos(ctx, data)] = ctx->table[hash];
-		ctx->table[hash] = data++;
+		ctx->table[hash] = XpressDictionary_pos(ctx, data);
 	}
 }
 	
-static void Add2(XpressDictionary *ctx, const uint8_t* data, size_t len)
+static inline void Add2(XpressDictionary *ctx, const uint8_t* data, size_t len)
 {
 	if (data >= ctx->end2) { return; }
-	uint32_t pos = WindowPos(ctx, data);
+	uint32_t pos = WindowPos(ctx, data), p = XpressDictionary_pos(ctx, data);
 	const const uint8_t* end = ((data + len) < ctx->end2) ? data + len : ctx->end2;
 	uint_fast16_t hash = HashUpdate(ctx, data[0], data[1]);
 	while (data < end)
 	{
 		hash = HashUpdate(ctx, hash, data[2]);
-		ctx->window[pos++] = ctx->table[hash];
-		ctx->table[hash] = data++;
+		ctx->window[pos++ & ctx->WindowMask] = ctx->table[hash];
+		ctx->table[hash] = p++;
+		++data;
 	}
 }
 
-static void Add0(int count, ...)
+static inline void Add0(int count, ...)
 {
-	int i;
 	XpressDictionary *ctx;
 	const uint8_t* data;
 	size_t len;
@@ -165,24 +308,82 @@ static void Add0(int count, ...)
 
 #define Add(...) Add0(COUNT_PARMS(__VA_ARGS__), __VA_ARGS__)
 
-uint32_t Find(XpressDictionary *ctx, const const uint8_t* data, uint32_t* offset)
+// Turns the adaptive chain depth on or off, it starts from MaxChain
+static inline void XpressDictionary_set_adaptive(XpressDictionary *ctx, int adaptive)
+{
+	ctx->Adaptive = adaptive;
+	ctx->ChainLimit = ctx->MaxChain;
+	ctx->MissRun = 0;
+}
+
+// Adjusts the chain depth of the next Find after one that walked limit entries and found a match of
+// len at step depth (0 if nothing was found). The walk is halved after ADAPT_MISS_RUN Finds in a row
+// found nothing and shortened by an eighth after a match of at least half the nice length or one
+// found early in the walk, since looking further rarely finds anything better there. It is doubled
+// when the best match was found in the last quarter of the walk, since the matches are still getting
+// better deeper in the chain. It stays within MaxChain/ADAPT_MIN_DIV and MaxChain*ADAPT_MAX_MUL.
+#define ADAPT_MISS_RUN		8
+#define ADAPT_MIN_DIV		8
+#define ADAPT_MAX_MUL		4
+static inline void XpressDictionary_adapt(XpressDictionary *ctx, uint32_t len, uint32_t depth, uint32_t limit)
+{
+	const uint32_t min = ctx->MaxChain / ADAPT_MIN_DIV ? ctx->MaxChain / ADAPT_MIN_DIV : 1, max = ctx->MaxChain * ADAPT_MAX_MUL;
+	if (depth == 0)
+	{
+		if (++ctx->MissRun >= ADAPT_MISS_RUN) { limit /= 2; ctx->MissRun = 0; }
+	}
+	else
+	{
+		ctx->MissRun = 0;
+		if (depth >= limit - limit / 4 && len < ctx->NiceLength) { limit *= 2; }
+		else if (len >= ctx->NiceLength / 2 || depth <= limit / 4) { limit -= limit / 8; }
+	}
+	ctx->ChainLimit = limit < min ? min : (limit > max ? max : limit);
+}
+
+// The number of the highest set bit of x (which is not 0)
+static inline uint32_t XpressDictionary_high_bit(uint32_t x)
+{
+#ifdef __GNUC__
+	return 31 - __builtin_clz(x);
+#else
+	uint32_t n = 0;
+	while (x >>= 1) { ++n; }
+	return n;
+#endif
+}
+
+// The bits a match of len at offset saves over writing its bytes as literals, in 1/16 bits: the match
+// symbol (which has the highest bit of the offset and up to 15 of the length), the rest of the offset
+// and the extra length bytes. A match that is a little longer but much further away can save less.
+static inline int64_t XpressDictionary_score(const XpressDictionary *ctx, uint32_t len, uint32_t offset)
+{
+	const uint32_t off_bits = XpressDictionary_high_bit(offset), l = len - 3;
+	uint32_t bits = ctx->Costs[0x100 | (off_bits << 4) | (l < 0xF ? l : 0xF)] + off_bits;
+	if (l >= 0xF) { bits += l < 0xFF + 0xF ? 8 : (l <= 0xFFFF ? 24 : 56); }
+	return (int64_t)len * ctx->LiteralCost - (int64_t)(bits << 4);
+}
+
+static inline uint32_t Find(XpressDictionary *ctx, const const uint8_t* data, uint32_t* offset)
 {
 #if PNTR_BITS <= 32
 	const const uint8_t* endx = ctx->end; // on 32-bit, + UINT32_MAX will always overflow
 #else
 	const const uint8_t* endx = ((data + UINT32_MAX) < data || (data + UINT32_MAX) >= ctx->end) ? ctx->end : data + UINT32_MAX; // if overflow or past end use the end
 #endif
+	const uint32_t pos = XpressDictionary_pos(ctx, data), xend = pos - ctx->MaxOffset, mask = ctx->WindowMask;
 #ifdef MSCOMP_WITH_UNALIGNED_ACCESS
-	const const uint8_t* xend = data - MAX_OFFSET, end4 = endx - 4;
+	const const uint8_t* end4 = endx - 4;
 	const uint16_t prefix = *(uint16_t*)data;
 #else
-	const const uint8_t* xend = data - MAX_OFFSET;
 	const uint8_t prefix0 = data[0], prefix1 = data[1];
 #endif
-	const uint8_t* x;
-	uint32_t len = 2, chain_length = MAX_CHAIN;
-	for (x = ctx->window[WindowPos(ctx, data)]; chain_length && x >= xend; x = ctx->window[WindowPos(ctx, x)], --chain_length)
+	const uint32_t limit = ctx->Adaptive ? ctx->ChainLimit : ctx->MaxChain;
+	uint32_t xpos, len = 2, chain_length = limit, depth = 0;
+	int64_t score = 0, best = 0; // with costs only matches that save bits are taken
+	for (xpos = ctx->window[pos & mask]; chain_length && xpos >= xend; xpos = ctx->window[xpos & mask], --chain_length)
 	{
+		const const uint8_t* x = data - (pos - xpos);
 #ifdef MSCOMP_WITH_UNALIGNED_ACCESS
 		if (*(uint16_t*)x == prefix)
 		{
@@ -194,14 +395,21 @@ uint32_t Find(XpressDictionary *ctx, const const uint8_t* data, uint32_t* offset
 			// at ctx point the at least 3 bytes are matched (due to the hashing function forcing byte 3 to the same)
 			const uint32_t l = GetMatchLength(x, data, endx);
 #endif
-			if (l > len)
+			// The chain goes from the closest to the furthest, so with costs a match further away only
+			// wins when it is longer and saves more bits
+			if (l > len && (!ctx->Costs || (score = XpressDictionary_score(ctx, l, pos - xpos)) > best))
 			{
-				*offset = (uint32_t)(data - x);
+				best = score;
+				*offset = pos - xpos;
 				len = l;
-				if (len >= NICE_LENGTH) { break; }
+				depth = limit - chain_length + 1;
+				if (len >= ctx->NiceLength) { ++ctx->NiceHits; --chain_length; break; }
 			}
 		}
 	}
+	++ctx->FindCount;
+	ctx->ChainSteps += limit - chain_length;
+	if (ctx->Adaptive) { XpressDictionary_adapt(ctx, len, depth, limit); }
 	return len;
 }
 
@@ -0,0 +1,190 @@
+// ms-compress: implements Microsoft compression algorithms
+// Copyright (C) 2018 David Mulder <dmulder@suse.com>
+//
+// This library is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This library is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+
+#include <errno.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "lznt1.h"
+#include "XpressDictionary.h"
+#include "mscomp_endian.h"
+
+////////////////////////////// General Definitions and Functions ///////////////////////////////////
+// Each chunk starts with a uint16 header: the size of the chunk including the header - 3 in the lower
+// 12 bits, the signature 3 in the next 3 bits and whether the chunk is compressed in the highest bit.
+// An uncompressed chunk is just the bytes. A compressed chunk is a flag byte for each 8 tokens (the
+// lowest bit is the first token): a 0 bit is a literal byte and a 1 bit a uint16 phrase. A phrase has
+// the offset - 1 in the upper bits and the length - 3 in the lower bits, where the number of offset
+// bits is just enough for the position in the chunk (at least 4, at most 12).
+#define LZNT1_CHUNK_SIZE	0x1000
+#define LZNT1_SIGNATURE		0x3000
+#define LZNT1_COMPRESSED	0x8000
+
+size_t lznt1_max_compressed_size(size_t in_len) { return in_len + 2 * ((in_len + LZNT1_CHUNK_SIZE - 1) / LZNT1_CHUNK_SIZE); }
+
+// The number of bits of a phrase at position pos (> 0) of a chunk that hold the length
+static unsigned lznt1_length_bits(size_t pos)
+{
+	unsigned bits = 12;
+	for (pos -= 1; pos >= 0x10; pos >>= 1) { --bits; }
+	return bits;
+}
+
+////////////////////////////// Compression Functions ///////////////////////////////////////////////
+// Compresses a chunk into out, returns the number of bytes written or 0 if it does not compress into
+// fewer than in_len bytes or does not fit in out_len bytes
+static size_t lznt1_compress_chunk(XpressDictionary* d, const uint8_t* in, size_t in_len, uint8_t* out, size_t out_len)
+{
+	const const uint8_t* in_start = in, *in_end = in + in_len;
+	const uint8_t* out_orig = out, *out_end = out + (out_len < in_len - 1 ? out_len : in_len - 1);
+
+	// Matches cannot go past the end of the chunk (Fill only uses end2, which is left alone)
+	d->end = in_end;
+	while (in < in_end)
+	{
+		if (out == out_end) { return 0; }
+		uint8_t* flags_out = out++, flags = 0;
+		for (uint_fast8_t i = 0; i < 8 && in < in_end; ++i)
+		{
+			const size_t pos = in - in_start;
+			uint32_t len, off;
+
+			// Matches cannot go before the start of the chunk
+			d->MaxOffset = (uint32_t)pos;
+			if (pos > 0 && in_end - in >= 3 && (len = Find(d, in, &off)) >= 3)
+			{
+				const unsigned length_bits = lznt1_length_bits(pos);
+				const uint32_t max_len = (1u << length_bits) + 2;
+				if (len > max_len) { len = max_len; }
+				if (out_end - out < 2) { return 0; }
+				SET_UINT16(out, ((off - 1) << length_bits) | (len - 3)); out += 2;
+				in += len;
+				flags |= 1 << i;
+			}
+			else
+			{
+				if (out == out_end) { return 0; }
+				*out++ = *in++;
+			}
+		}
+		*flags_out = flags;
+	}
+	return out - out_orig;
+}
+
+int lznt1_compress(const uint8_t* in, size_t in_len, uint8_t* out, size_t* _out_len)
+{
+	if (in_len == 0) { *_out_len = 0; return 0; }
+	XpressDictionary d;
+	if (XpressDictionary_init(&d, in, in + in_len) != 0) { return ENOMEM; }
+
+	const const uint8_t* in_end = in + in_len, *filled = in;
+	const uint8_t* out_orig = out, *out_end = out + *_out_len;
+	int err = 0;
+	while (in < in_end)
+	{
+		const size_t len = (size_t)(in_end - in) < LZNT1_CHUNK_SIZE ? (size_t)(in_end - in) : LZNT1_CHUNK_SIZE;
+
+		// The dictionary is filled 16 chunks at a time
+		if (in >= filled && filled < d.end2)
+		{
+			if ((size_t)(filled - d.start) >= MAX_POS) { XpressDictionary_reset(&d, filled - CHUNK_SIZE, in_end); Fill(&d, filled - CHUNK_SIZE); }
+			filled = Fill(&d, filled);
+		}
+
+		if (out_end - out < 2) { err = ENOBUFS; break; }
+		size_t comp_len = lznt1_compress_chunk(&d, in, len, out + 2, out_end - out - 2);
+		if (comp_len)
+		{
+			SET_UINT16(out, LZNT1_COMPRESSED | LZNT1_SIGNATURE | (comp_len - 1));
+		}
+		else
+		{
+			// Store the chunk as is
+			if ((size_t)(out_end - out - 2) < len) { err = ENOBUFS; break; }
+			SET_UINT16(out, LZNT1_SIGNATURE | (len - 1));
+			memcpy(out + 2, in, len);
+			comp_len = len;
+		}
+		in += len;
+		out += 2 + comp_len;
+	}
+
+	XpressDictionary_free(&d);
+	if (!err) { *_out_len = out - out_orig; }
+	return err;
+}
+
+////////////////////////////// Decompression Functions /////////////////////////////////////////////
+static int lznt1_decompress_chunk(const uint8_t* in, const const uint8_t* in_end, uint8_t** _out, const const uint8_t* out_end)
+{
+	uint8_t* out = *_out;
+	const const uint8_t* out_start = out, * chunk_end = out + LZNT1_CHUNK_SIZE; // a chunk decompresses to at most 4 KiB
+	while (in < in_end)
+	{
+		uint8_t flags = *in++;
+		for (uint_fast8_t i = 0; i < 8 && in < in_end; ++i, flags >>= 1)
+		{
+			if (flags & 1)
+			{
+				const size_t pos = out - out_start;
+				if (in_end - in < 2 || pos == 0) { return EINVAL; }
+				const unsigned length_bits = lznt1_length_bits(pos);
+				const uint_fast16_t phrase = GET_UINT16(in); in += 2;
+				const size_t off = (phrase >> length_bits) + 1, len = (phrase & ((1u << length_bits) - 1)) + 3;
+				if (off > pos || (size_t)(chunk_end - out) < len) { return EINVAL; }
+				if ((size_t)(out_end - out) < len) { return ENOBUFS; }
+				for (const uint8_t* end = out + len; out < end; ++out) { *out = *(out - off); } // the copy can overlap itself
+			}
+			else
+			{
+				if (out == chunk_end) { return EINVAL; }
+				if (out == out_end) { return ENOBUFS; }
+				*out++ = *in++;
+			}
+		}
+	}
+	*_out = out;
+	return 0;
+}
+
+int lznt1_decompress(const uint8_t* in, size_t in_len, uint8_t* out, size_t* _out_len)
+{
+	const const uint8_t* in_end = in + in_len;
+	const uint8_t* out_orig = out, *out_end = out + *_out_len;
+	while (in_end - in >= 2)
+	{
+		const uint_fast16_t header = GET_UINT16(in);
+		if (header == 0) { break; }
+		in += 2;
+		const size_t size = (header & 0xFFF) + 1;
+		if ((size_t)(in_end - in) < size) { return EINVAL; }
+		if (header & LZNT1_COMPRESSED)
+		{
+			const int err = lznt1_decompress_chunk(in, in + size, &out, out_end);
+			if (err) { return err; }
+		}
+		else
+		{
+			if ((size_t)(out_end - out) < size) { return ENOBUFS; }
+			memcpy(out, in, size);
+			out += size;
+		}
+		in += size;
+	}
+	*_out_len = out - out_orig;
+	return 0;
+}
@@ -0,0 +1,46 @@
+// ms-compress: implements Microsoft compression algorithms
+// Copyright (C) 2018 David Mulder <dmulder@suse.com>
+//
+// This library is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This library is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+
+////////////////////////////// LZNT1 ///////////////////////////////////////////////////////////////
+// The public interface of LZNT1 (MS-XCA 2.5) compression and decompression. LZNT1 works on 4 KiB
+// chunks that are each compressed with LZ77 on their own and has no entropy coding, so it is fast
+// but does not compress as well as Xpress Huffman. The compressor uses the same match finder as
+// Xpress Huffman with the default level's settings.
+// All functions that return int return 0 on success or an errno value:
+//   ENOMEM   an allocation failed
+//   EINVAL   the compressed data is invalid
+//   ENOBUFS  the output buffer is too small (see lznt1_max_compressed_size)
+
+#ifndef MSCOMP_LZNT1_H
+#define MSCOMP_LZNT1_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// The largest output lznt1_compress can produce for in_len bytes of input
+size_t lznt1_max_compressed_size(size_t in_len);
+
+// Compresses in into out. On input *out_len is the size of out, on success it is set to the number
+// of bytes written. No end of stream marker is written.
+int lznt1_compress(const uint8_t* in, size_t in_len, uint8_t* out, size_t* out_len);
+
+// Decompresses in into out. On input *out_len is the size of out, on success it is set to the number
+// of bytes written. Decompression stops at the end of the input or at a chunk header of 0. Chunks
+// are not padded to 4 KiB, the output is just the decompressed chunks one after another.
+int lznt1_decompress(const uint8_t* in, size_t in_len, uint8_t* out, size_t* out_len);
+
+#endif
@@ -0,0 +1,48 @@
+// ms-compress: implements Microsoft compression algorithms
+// Copyright (C) 2018 David Mulder <dmulder@suse.com>
+//
+// This library is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This library is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+
+////////////////////////////// Allocator ///////////////////////////////////////////////////////////
+// Lets the user supply the memory of a compression context, for example from a slab allocator, a
+// huge-page pool or a per-thread arena. opaque is passed to both functions. alloc returns NULL when
+// out of memory, free is never called with NULL. A NULL allocator (or a NULL alloc) uses malloc/free.
+
+#ifndef MSCOMP_ALLOCATOR_H
+#define MSCOMP_ALLOCATOR_H
+
+#include <stddef.h>
+#include <stdlib.h>
+
+typedef struct
+{
+	void* (*alloc)(void* opaque, size_t size);
+	void (*free)(void* opaque, void* ptr);
+	void* opaque;
+} mscomp_allocator;
+
+static inline void* mscomp_alloc(const mscomp_allocator* a, size_t size)
+{
+	return (a && a->alloc) ? a->alloc(a->opaque, size) : malloc(size);
+}
+
+static inline void mscomp_free(const mscomp_allocator* a, void* ptr)
+{
+	if (ptr == NULL) { return; }
+	if (a && a->alloc) { (a->free)(a->opaque, ptr); }
+	else { free(ptr); }
+}
+
+#endif
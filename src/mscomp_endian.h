@@ -0,0 +1,56 @@
+// ms-compress: implements Microsoft compression algorithms
+// Copyright (C) 2018 David Mulder <dmulder@suse.com>
+//
+// This library is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This library is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+
+////////////////////////////// Byte Order ////////////////////////////////////////////////////////
+// Reading and writing little-endian uint16s and uint32s at any address. The _RAW versions skip the
+// byte swap on big-endian machines (for data that never leaves the machine).
+
+#ifndef MSCOMP_ENDIAN_H
+#define MSCOMP_ENDIAN_H
+
+#include <stdint.h>
+
+#if defined(MSCOMP_WITH_UNALIGNED_ACCESS)
+        #define GET_UINT16_RAW(x)               (*(const uint16_t*)(x))
+        #define GET_UINT32_RAW(x)               (*(const uint32_t*)(x))
+        #define SET_UINT16_RAW(x,val)   (*(uint16_t*)(x) = (uint16_t)(val))
+        #define SET_UINT32_RAW(x,val)   (*(uint32_t*)(x) = (uint32_t)(val))
+        #if defined(MSCOMP_LITTLE_ENDIAN)
+                #define GET_UINT16(x)           GET_UINT16_RAW(x)
+                #define GET_UINT32(x)           GET_UINT32_RAW(x)
+                #define SET_UINT16(x,val)       SET_UINT16_RAW(x,val)
+                #define SET_UINT32(x,val)       SET_UINT32_RAW(x,val)
+        #elif defined(MSCOMP_BIG_ENDIAN)
+                // These could also use the without-unaligned-access versions always
+                #define GET_UINT16(x)           byte_swap(*(const uint16_t*)(x))
+                #define GET_UINT32(x)           byte_swap(*(const uint32_t*)(x))
+                #define SET_UINT16(x,val)       (*(uint16_t*)(x) = byte_swap((uint16_t)(val)))
+                #define SET_UINT32(x,val)       (*(uint32_t*)(x) = byte_swap((uint32_t)(val)))
+        #endif
+#else // if MSCOMP_WITHOUT_UNALIGNED_ACCESS:
+        // When not using unaligned access, nothing needs to be done for different endians
+        #define GET_UINT16_RAW(x)               (((uint8_t*)(x))[0]|(((uint8_t*)(x))[1]<<8))
+        #define GET_UINT32_RAW(x)               (((uint8_t*)(x))[0]|(((uint8_t*)(x))[1]<<8)|(((uint8_t*)(x))[2]<<16)|((uint32_t)((uint8_t*)(x))[3]<<24))
+        #define SET_UINT16_RAW(x,val)   (((uint8_t*)(x))[0]=(uint8_t)(val), ((uint8_t*)(x))[1]=(uint8_t)((val)>>8))
+        #define SET_UINT32_RAW(x,val)   (((uint8_t*)(x))[0]=(uint8_t)(val), ((uint8_t*)(x))[1]=(uint8_t)((val)>>8), ((uint8_t*)(x))[2]=(uint8_t)((val)>>16), ((uint8_t*)(x))[3]=(uint8_t)((val)>>24))
+        #define GET_UINT16(x)                   GET_UINT16_RAW(x)
+        #define GET_UINT32(x)                   GET_UINT32_RAW(x)
+        #define SET_UINT16(x,val)               SET_UINT16_RAW(x,val)
+        #define SET_UINT32(x,val)               SET_UINT32_RAW(x,val)
+#endif
+
+#endif
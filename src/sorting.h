@@ -24,7 +24,7 @@
 // Use insertion-sort so that it is stable, keeping symbols in increasing order
 // This is only used at the tail end of merge_sort.
 #define insertion_sort(type) \
-void insertion_sort_##type(uint16_t* syms, const type* const conditions, const uint_fast16_t len) \
+static inline void insertion_sort_##type(uint16_t* syms, const type* const conditions, const uint_fast16_t len) \
 { \
 	for (uint_fast16_t i = 1; i < len; ++i) \
 	{ \
@@ -41,7 +41,7 @@ insertion_sort(uint32_t)
 // Merge-sorts syms[l, r) using conditions[syms[x]]
 // Use merge-sort so that it is stable, keeping symbols in increasing order
 #define merge_sort(type) \
-void merge_sort_##type(uint16_t* syms, uint16_t* temp, const type* const conditions, const uint_fast16_t len) \
+static inline void merge_sort_##type(uint16_t* syms, uint16_t* temp, const type* const conditions, const uint_fast16_t len) \
 { \
 	if (len < SORT_SWITCH_TO_INSERT_LIMIT) \
 	{ \
@@ -0,0 +1,222 @@
+// ms-compress: implements Microsoft compression algorithms
+// Copyright (C) 2018 David Mulder <dmulder@suse.com>
+//
+// This library is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This library is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+
+#include <math.h>
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "xpress_auto_compress.h"
+#include "xpress_huff_compress.h"
+#include "xpress_compress.h"
+#include "lznt1.h"
+
+////////////////////////////// Sampling ////////////////////////////////////////////////////////////
+// Up to SAMPLE_SLICES slices of SAMPLE_SLICE bytes spread over the input are looked at. Each slice
+// gets a quick greedy LZ77 pass with a small hash table (without chains) to estimate how much of the
+// input matches and how long the matches are, along with the byte histogram for the entropy.
+#define SAMPLE_SLICES		4
+#define SAMPLE_SLICE		0x1000
+#define SAMPLE_HASH_BITS	12
+
+typedef struct
+{
+	double entropy;  // bits per byte
+	double matched;  // fraction of the bytes that are in matches
+	double matches;  // matches per byte
+} xa_sample;
+
+static uint32_t xa_hash(const uint8_t* x)
+{
+	uint32_t v;
+	memcpy(&v, x, sizeof(v));
+	return (v * 0x9E3779B1u) >> (32 - SAMPLE_HASH_BITS);
+}
+
+static void xa_sample_input(const uint8_t* in, size_t in_len, xa_sample* s)
+{
+	uint32_t counts[0x100] = { 0 };
+	uint16_t table[1 << SAMPLE_HASH_BITS];
+	size_t total = 0, matched = 0, matches = 0;
+	const size_t slices = in_len <= SAMPLE_SLICES * SAMPLE_SLICE ? 1 : SAMPLE_SLICES;
+	const size_t slice_len = slices == 1 ? in_len : SAMPLE_SLICE, step = slices == 1 ? 0 : (in_len - SAMPLE_SLICE) / (SAMPLE_SLICES - 1);
+	for (size_t i = 0; i < slices; ++i)
+	{
+		const uint8_t* slice = in + i * step;
+		for (size_t j = 0; j < slice_len; ++j) { ++counts[slice[j]]; }
+		total += slice_len;
+
+		memset(table, 0xFF, sizeof(table));
+		for (size_t j = 0; j + 4 <= slice_len; )
+		{
+			const uint32_t h = xa_hash(slice + j);
+			const size_t x = table[h];
+			table[h] = (uint16_t)j;
+			if (x != 0xFFFF && memcmp(slice + x, slice + j, 4) == 0)
+			{
+				size_t len = 4;
+				while (j + len < slice_len && slice[x + len] == slice[j + len]) { ++len; }
+				matched += len;
+				++matches;
+				j += len;
+			}
+			else { ++j; }
+		}
+	}
+
+	s->entropy = 0;
+	for (uint_fast16_t i = 0; i < 0x100; ++i) { if (counts[i]) { const double p = (double)counts[i] / total; s->entropy -= p * log2(p); } }
+	s->matched = (double)matched / total;
+	s->matches = (double)matches / total;
+}
+
+////////////////////////////// Estimates ///////////////////////////////////////////////////////////
+// The expected output size per input byte of each algorithm, from the sample: literals cost their
+// entropy with Huffman and a byte (plus a flag bit) otherwise, matches cost about 2 bytes plus their
+// flag bit (or their Huffman symbol and offset bits), and each chunk has its fixed overhead.
+static double xa_estimate_size(xpress_auto_algorithm algorithm, const xa_sample* s, size_t in_len)
+{
+	const double literals = 1 - s->matched;
+	switch (algorithm)
+	{
+	case XPRESS_AUTO_XPRESS_HUFF: return literals * s->entropy / 8 + s->matches * 2.0 + 256.0 * ((in_len + 0xFFFF) / 0x10000) / in_len;
+	case XPRESS_AUTO_XPRESS:      return (literals + s->matches) / 32 + literals + s->matches * 2.25 + 4.0 / in_len;
+	case XPRESS_AUTO_LZNT1:       return (literals + s->matches) / 8 + literals + s->matches * 2.0 + 2.0 / 0x1000;
+	default:                      return 1;
+	}
+}
+
+// The time each algorithm takes as a fixed cost in ns plus a cost in ns per byte, measured on a
+// x86-64 server. The context corrects these with a factor for each algorithm learned from timing the
+// compressions it does.
+static const double xa_fixed_ns[XPRESS_AUTO_ALGORITHMS]    = { 0, 2000, 2000, 20000 };
+static const double xa_ns_per_byte[XPRESS_AUTO_ALGORITHMS] = { 0.1, 16, 18, 32 };
+
+// The factor of an algorithm is only measured when it runs, so one slow run (a page fault, being
+// preempted) could keep it out of the budget for good. Each call that does not run it moves its
+// factor this part of the way back to 1 so that it is tried again.
+#define SCALE_DECAY	0.0625
+
+struct _xpress_auto_ctx
+{
+	xpress_huff_ctx* huff;
+	unsigned allowed;
+	double scale[XPRESS_AUTO_ALGORITHMS]; // measured time / estimated time
+};
+
+static double xa_estimate_ns(const xpress_auto_ctx* ctx, xpress_auto_algorithm algorithm, size_t in_len)
+{
+	return ctx->scale[algorithm] * (xa_fixed_ns[algorithm] + xa_ns_per_byte[algorithm] * in_len);
+}
+
+static uint64_t xa_now_ns(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000u + (uint64_t)ts.tv_nsec;
+}
+
+////////////////////////////// Context /////////////////////////////////////////////////////////////
+xpress_auto_ctx* xpress_auto_ctx_new(void)
+{
+	xpress_auto_ctx* ctx = (xpress_auto_ctx*)malloc(sizeof(xpress_auto_ctx));
+	if (ctx == NULL) { return NULL; }
+	if ((ctx->huff = xpress_huff_ctx_new()) == NULL) { free(ctx); return NULL; }
+	ctx->allowed = XPRESS_AUTO_ALLOW_ALL;
+	for (uint_fast8_t i = 0; i < XPRESS_AUTO_ALGORITHMS; ++i) { ctx->scale[i] = 1; }
+	return ctx;
+}
+
+void xpress_auto_ctx_free(xpress_auto_ctx* ctx)
+{
+	if (ctx)
+	{
+		xpress_huff_ctx_free(ctx->huff);
+		free(ctx);
+	}
+}
+
+void xpress_auto_ctx_set_algorithms(xpress_auto_ctx* ctx, unsigned allowed)
+{
+	ctx->allowed = allowed | XPRESS_AUTO_ALLOW(XPRESS_AUTO_NONE);
+}
+
+////////////////////////////// Compression /////////////////////////////////////////////////////////
+size_t xpress_auto_max_compressed_size(size_t in_len)
+{
+	size_t size = xpress_huff_max_compressed_size(in_len);
+	if (xpress_max_compressed_size(in_len) > size) { size = xpress_max_compressed_size(in_len); }
+	if (lznt1_max_compressed_size(in_len) > size) { size = lznt1_max_compressed_size(in_len); }
+	return size;
+}
+
+// Chooses the fastest allowed algorithm that fits the budget and whose estimated output is within
+// 2% of the input size of the smallest one. Since storing the input as is is always the fastest, an
+// algorithm has to save more than 2% to be used at all.
+#define CHOOSE_TOLERANCE	0.02
+
+static xpress_auto_algorithm xa_choose(const xpress_auto_ctx* ctx, const uint8_t* in, size_t in_len, uint64_t budget_ns)
+{
+	xa_sample s;
+	xa_sample_input(in, in_len, &s);
+	double size[XPRESS_AUTO_ALGORITHMS], best_size = 1;
+	for (uint_fast8_t i = 0; i < XPRESS_AUTO_ALGORITHMS; ++i)
+	{
+		size[i] = -1;
+		if (!(ctx->allowed & XPRESS_AUTO_ALLOW(i)) || (budget_ns && xa_estimate_ns(ctx, (xpress_auto_algorithm)i, in_len) > budget_ns)) { continue; }
+		size[i] = xa_estimate_size((xpress_auto_algorithm)i, &s, in_len);
+		if (size[i] < best_size) { best_size = size[i]; }
+	}
+	xpress_auto_algorithm algorithm = XPRESS_AUTO_NONE;
+	for (uint_fast8_t i = 1; i < XPRESS_AUTO_ALGORITHMS; ++i)
+	{
+		if (size[i] >= 0 && size[i] <= best_size + CHOOSE_TOLERANCE && (algorithm == XPRESS_AUTO_NONE ? 1 > best_size + CHOOSE_TOLERANCE :
+			xa_estimate_ns(ctx, (xpress_auto_algorithm)i, in_len) < xa_estimate_ns(ctx, algorithm, in_len))) { algorithm = (xpress_auto_algorithm)i; }
+	}
+	return algorithm;
+}
+
+int xpress_auto_compress(xpress_auto_ctx* ctx, const uint8_t* in, size_t in_len, uint8_t* out, size_t* out_len, uint64_t budget_ns, xpress_auto_algorithm* algorithm)
+{
+	xpress_auto_algorithm chosen = in_len ? xa_choose(ctx, in, in_len, budget_ns) : XPRESS_AUTO_NONE;
+	for (uint_fast8_t i = 1; i < XPRESS_AUTO_ALGORITHMS; ++i) { if (i != chosen) { ctx->scale[i] += SCALE_DECAY * (1 - ctx->scale[i]); } }
+	if (chosen != XPRESS_AUTO_NONE)
+	{
+		size_t comp_len = *out_len;
+		const uint64_t start = xa_now_ns();
+		int err;
+		switch (chosen)
+		{
+		case XPRESS_AUTO_XPRESS_HUFF: err = xpress_huff_compress_ctx(ctx->huff, in, in_len, out, &comp_len, NULL); break;
+		case XPRESS_AUTO_XPRESS:      err = xpress_compress(in, in_len, out, &comp_len); break;
+		default:                      err = lznt1_compress(in, in_len, out, &comp_len); break;
+		}
+		const double ns = (double)(xa_now_ns() - start);
+
+		// Move the time estimate of the algorithm a quarter of the way to what was measured
+		ctx->scale[chosen] = 0.75 * ctx->scale[chosen] + 0.25 * ns / (xa_fixed_ns[chosen] + xa_ns_per_byte[chosen] * in_len);
+		if (err == 0 && comp_len < in_len) { *out_len = comp_len; *algorithm = chosen; return 0; }
+		if (err != 0 && err != ENOBUFS) { return err; }
+	}
+
+	// Store the input as is
+	if (*out_len < in_len) { return ENOBUFS; }
+	memcpy(out, in, in_len);
+	*out_len = in_len;
+	*algorithm = XPRESS_AUTO_NONE;
+	return 0;
+}
@@ -0,0 +1,69 @@
+// ms-compress: implements Microsoft compression algorithms
+// Copyright (C) 2018 David Mulder <dmulder@suse.com>
+//
+// This library is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This library is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+
+////////////////////////////// Automatic Algorithm Selection ///////////////////////////////////////
+// Chooses the algorithm for each payload from a quick look at a sample of it (its byte entropy and
+// how much of it repeats) and from how long each algorithm is expected to take, then compresses
+// with it. Meant for protocols like SMB2 that negotiate several algorithms and can pick one for each
+// message.
+// All functions that return int return 0 on success or an errno value:
+//   ENOMEM   an allocation failed
+//   ENOBUFS  the output buffer is too small (see xpress_auto_max_compressed_size)
+
+#ifndef MSCOMP_XPRESS_AUTO_COMPRESS_H
+#define MSCOMP_XPRESS_AUTO_COMPRESS_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// The algorithms, numbered like the SMB2 compression algorithm ids
+typedef enum
+{
+	XPRESS_AUTO_NONE        = 0, // the input is copied as is
+	XPRESS_AUTO_LZNT1       = 1, // lznt1_compress
+	XPRESS_AUTO_XPRESS      = 2, // xpress_compress (plain LZ77)
+	XPRESS_AUTO_XPRESS_HUFF = 3, // xpress_huff_compress
+	XPRESS_AUTO_ALGORITHMS
+} xpress_auto_algorithm;
+
+#define XPRESS_AUTO_ALLOW(algorithm) (1u << (algorithm))
+#define XPRESS_AUTO_ALLOW_ALL        ((1u << XPRESS_AUTO_ALGORITHMS) - 1)
+
+// A context holds the Xpress Huffman context that is reused for each call and the timings the
+// estimates of how long each algorithm takes are corrected with. A context may be used for any
+// number of calls, but only by one thread at a time.
+typedef struct _xpress_auto_ctx xpress_auto_ctx;
+
+// Creates and frees a context. Returns NULL if out of memory.
+xpress_auto_ctx* xpress_auto_ctx_new(void);
+void xpress_auto_ctx_free(xpress_auto_ctx* ctx);
+
+// Limits the algorithms that can be chosen to the XPRESS_AUTO_ALLOW bits in allowed (for example the
+// ones negotiated with the peer). No compression is always allowed. The default is all of them.
+void xpress_auto_ctx_set_algorithms(xpress_auto_ctx* ctx, unsigned allowed);
+
+// The largest output xpress_auto_compress can produce for in_len bytes of input
+size_t xpress_auto_max_compressed_size(size_t in_len);
+
+// Compresses in into out with the algorithm expected to give the smallest output within budget_ns
+// nanoseconds (0 for no limit). When no algorithm is expected to fit the budget or to make the
+// output smaller, or when the chosen one does not, the input is copied as is. On input *out_len is
+// the size of out, on success it is set to the number of bytes written and *algorithm to the
+// algorithm used.
+int xpress_auto_compress(xpress_auto_ctx* ctx, const uint8_t* in, size_t in_len, uint8_t* out, size_t* out_len, uint64_t budget_ns, xpress_auto_algorithm* algorithm);
+
+#endif
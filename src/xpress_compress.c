@@ -0,0 +1,122 @@
+// ms-compress: implements Microsoft compression algorithms
+// Copyright (C) 2018 David Mulder <dmulder@suse.com>
+//
+// This library is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This library is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+
+#include <errno.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "xpress_compress.h"
+#include "XpressDictionary.h"
+#include "mscomp_endian.h"
+
+////////////////////////////// General Definitions and Functions ///////////////////////////////////
+// Plain Xpress is a single stream of 32-bit flag words each followed by the 32 symbols they describe
+// (the highest bit is the first symbol): a 0 bit is a literal byte and a 1 bit is a match. A match is
+// a uint16 with the offset - 1 in the upper 13 bits and the length - 3 (up to 7) in the lower 3. For
+// longer matches the length continues in a nibble (two matches share a byte), then a byte, then a
+// uint16 or a uint16 of 0 and a uint32 holding the whole length - 3. The last flag word has all of
+// its unused bits set.
+#define XPRESS_MAX_OFFSET	0x2000
+
+size_t xpress_max_compressed_size(size_t in_len) { return in_len + 4 + in_len / 32 * 4; }
+
+// The number of bytes a match of len (- 3) takes, nibble is set if half of a byte is available
+static size_t xp_match_size(uint32_t len, const int nibble)
+{
+	if (len < 7) { return 2; }
+	const size_t size = 2 + !nibble;
+	if (len < 7 + 15) { return size; }
+	if (len - (7 + 15) < 0xFF) { return size + 1; }
+	return size + (len < 0x10000 ? 3 : 7);
+}
+
+static uint8_t* xp_write_match(uint8_t* out, uint32_t len, uint32_t off, uint8_t** nibble)
+{
+	SET_UINT16(out, ((off - 1) << 3) | (len < 7 ? len : 7)); out += 2;
+	if (len < 7) { return out; }
+	const uint32_t len7 = len - 7, n = len7 < 15 ? len7 : 15;
+	if (*nibble) { **nibble |= (uint8_t)(n << 4); *nibble = NULL; }
+	else { *nibble = out; *out++ = (uint8_t)n; }
+	if (len7 < 15) { return out; }
+	if (len7 - 15 < 0xFF) { *out++ = (uint8_t)(len7 - 15); return out; }
+	*out++ = 0xFF;
+	if (len < 0x10000) { SET_UINT16(out, len); return out + 2; }
+	SET_UINT16(out, 0); SET_UINT32(out + 2, len);
+	return out + 6;
+}
+
+////////////////////////////// Compression Functions ///////////////////////////////////////////////
+static int xp_compress(XpressDictionary* d, const uint8_t* in, size_t in_len, uint8_t* out, size_t* _out_len)
+{
+	const const uint8_t* in_end = in + in_len, *filled = in;
+	const uint8_t* out_orig = out, *out_end = out + *_out_len;
+	uint8_t* flags_out = out, *nibble = NULL;
+	uint32_t flags = 0, flag_count = 0;
+	if (out_end - out < 4) { return ENOBUFS; }
+	out += 4;
+
+	while (in < in_end)
+	{
+		// The dictionary is filled a chunk at a time, a match can skip past the end of one or more
+		while (in >= filled && filled < d->end2)
+		{
+			if ((size_t)(filled - d->start) >= MAX_POS) { XpressDictionary_reset(d, filled - CHUNK_SIZE, in_end); Fill(d, filled - CHUNK_SIZE); }
+			filled = Fill(d, filled);
+		}
+
+		uint32_t len, off;
+		if (in_end - in >= 3 && (len = Find(d, in, &off)) >= 3)
+		{
+			len -= 3;
+			if ((size_t)(out_end - out) < xp_match_size(len, nibble != NULL)) { return ENOBUFS; }
+			out = xp_write_match(out, len, off, &nibble);
+			in += len + 3;
+			flags = (flags << 1) | 1;
+		}
+		else
+		{
+			if (out == out_end) { return ENOBUFS; }
+			*out++ = *in++;
+			flags <<= 1;
+		}
+
+		if (++flag_count == 32)
+		{
+			if (out_end - out < 4) { return ENOBUFS; }
+			SET_UINT32(flags_out, flags);
+			flags_out = out;
+			out += 4;
+			flags = 0;
+			flag_count = 0;
+		}
+	}
+
+	// Fill the unused flags with 1s
+	SET_UINT32(flags_out, (uint32_t)(((uint64_t)flags << (32 - flag_count)) | (((uint64_t)1 << (32 - flag_count)) - 1)));
+	*_out_len = out - out_orig;
+	return 0;
+}
+
+int xpress_compress(const uint8_t* in, size_t in_len, uint8_t* out, size_t* out_len)
+{
+	if (in_len == 0) { *out_len = 0; return 0; }
+	XpressDictionary d;
+	if (XpressDictionary_init(&d, in, in + in_len) != 0) { return ENOMEM; }
+	d.MaxOffset = XPRESS_MAX_OFFSET;
+	const int retval = xp_compress(&d, in, in_len, out, out_len);
+	XpressDictionary_free(&d);
+	return retval;
+}
@@ -0,0 +1,39 @@
+// ms-compress: implements Microsoft compression algorithms
+// Copyright (C) 2018 David Mulder <dmulder@suse.com>
+//
+// This library is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This library is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+
+////////////////////////////// Xpress Compression //////////////////////////////////////////////////
+// The public interface of the plain LZ77 Xpress compressor (MS-XCA 2.3), which has no Huffman stage
+// so it is much faster than Xpress Huffman but does not compress as well. It uses the same match
+// finder as Xpress Huffman with the default level's settings.
+// All functions that return int return 0 on success or an errno value:
+//   ENOMEM   an allocation failed
+//   ENOBUFS  the output buffer is too small (see xpress_max_compressed_size)
+
+#ifndef MSCOMP_XPRESS_COMPRESS_H
+#define MSCOMP_XPRESS_COMPRESS_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// The largest output xpress_compress can produce for in_len bytes of input
+size_t xpress_max_compressed_size(size_t in_len);
+
+// Compresses in into out. On input *out_len is the size of out, on success it is set to the number
+// of bytes written.
+int xpress_compress(const uint8_t* in, size_t in_len, uint8_t* out, size_t* out_len);
+
+#endif
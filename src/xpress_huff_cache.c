@@ -0,0 +1,222 @@
+// ms-compress: implements Microsoft compression algorithms
+// Copyright (C) 2018 David Mulder <dmulder@suse.com>
+//
+// This library is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This library is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include "xpress_huff_cache.h"
+#include "xpress_huff_compress.h"
+
+////////////////////////////// Hashing /////////////////////////////////////////////////////////////
+// XXH64 (with seed 0), reading the input in native byte order since the hashes never leave the cache
+#define PRIME64_1	0x9E3779B185EBCA87ull
+#define PRIME64_2	0xC2B2AE3D27D4EB4Full
+#define PRIME64_3	0x165667B19E3779F9ull
+#define PRIME64_4	0x85EBCA77C2B2AE63ull
+#define PRIME64_5	0x27D4EB2F165667C5ull
+
+static uint64_t xhc_rotl(uint64_t x, unsigned r) { return (x << r) | (x >> (64 - r)); }
+static uint64_t xhc_read64(const uint8_t* p) { uint64_t x; memcpy(&x, p, sizeof(x)); return x; }
+static uint32_t xhc_read32(const uint8_t* p) { uint32_t x; memcpy(&x, p, sizeof(x)); return x; }
+static uint64_t xhc_round(uint64_t acc, uint64_t x) { return xhc_rotl(acc + x * PRIME64_2, 31) * PRIME64_1; }
+static uint64_t xhc_merge(uint64_t h, uint64_t v) { return (h ^ xhc_round(0, v)) * PRIME64_1 + PRIME64_4; }
+
+static uint64_t xhc_hash(const uint8_t* in, size_t len)
+{
+	const uint8_t* const end = in + len;
+	uint64_t h;
+	if (len >= 32)
+	{
+		uint64_t v1 = PRIME64_1 + PRIME64_2, v2 = PRIME64_2, v3 = 0, v4 = 0 - PRIME64_1;
+		for (const uint8_t* const limit = end - 32; in <= limit; in += 32)
+		{
+			v1 = xhc_round(v1, xhc_read64(in));
+			v2 = xhc_round(v2, xhc_read64(in + 8));
+			v3 = xhc_round(v3, xhc_read64(in + 16));
+			v4 = xhc_round(v4, xhc_read64(in + 24));
+		}
+		h = xhc_rotl(v1, 1) + xhc_rotl(v2, 7) + xhc_rotl(v3, 12) + xhc_rotl(v4, 18);
+		h = xhc_merge(xhc_merge(xhc_merge(xhc_merge(h, v1), v2), v3), v4);
+	}
+	else { h = PRIME64_5; }
+	h += len;
+	for (; end - in >= 8; in += 8) { h = xhc_rotl(h ^ xhc_round(0, xhc_read64(in)), 27) * PRIME64_1 + PRIME64_4; }
+	if (end - in >= 4) { h = xhc_rotl(h ^ (xhc_read32(in) * PRIME64_1), 23) * PRIME64_2 + PRIME64_3; in += 4; }
+	for (; in < end; ++in) { h = xhc_rotl(h ^ (*in * PRIME64_5), 11) * PRIME64_1; }
+	h ^= h >> 33; h *= PRIME64_2;
+	h ^= h >> 29; h *= PRIME64_3;
+	h ^= h >> 32;
+	return h;
+}
+
+////////////////////////////// Cache ///////////////////////////////////////////////////////////////
+// The entries are in a hash table of chains and in a doubly linked list from the most to the least
+// recently used. Each entry is a single allocation holding the input followed by the output.
+#define MIN_BUCKETS		64
+
+typedef struct _xhc_entry
+{
+	struct _xhc_entry* chain;       // the next entry in the same bucket
+	struct _xhc_entry* prev, *next; // in the recently used list
+	uint64_t hash;
+	size_t in_len, out_len;
+	int level;
+	uint8_t data[];
+} xhc_entry;
+
+struct _xpress_huff_cache
+{
+	xpress_huff_ctx* ctx;
+	xhc_entry** buckets;
+	size_t n_buckets; // a power of 2
+	xhc_entry* head, *tail;
+	size_t memory_limit;
+	xpress_huff_cache_stats stats;
+};
+
+static size_t xhc_entry_size(size_t in_len, size_t out_len) { return sizeof(xhc_entry) + in_len + out_len; }
+
+static void xhc_unlink(xpress_huff_cache* cache, xhc_entry* e)
+{
+	if (e->prev) { e->prev->next = e->next; } else { cache->head = e->next; }
+	if (e->next) { e->next->prev = e->prev; } else { cache->tail = e->prev; }
+}
+
+static void xhc_push_front(xpress_huff_cache* cache, xhc_entry* e)
+{
+	e->prev = NULL;
+	e->next = cache->head;
+	if (cache->head) { cache->head->prev = e; } else { cache->tail = e; }
+	cache->head = e;
+}
+
+static void xhc_remove(xpress_huff_cache* cache, xhc_entry* e)
+{
+	xhc_entry** p = &cache->buckets[e->hash & (cache->n_buckets - 1)];
+	while (*p != e) { p = &(*p)->chain; }
+	*p = e->chain;
+	xhc_unlink(cache, e);
+	cache->stats.memory -= xhc_entry_size(e->in_len, e->out_len);
+	--cache->stats.entries;
+	free(e);
+}
+
+// Doubles the number of buckets once there are more entries than buckets, if the bigger table would
+// go over the memory limit or cannot be allocated the chains just get longer
+static void xhc_grow(xpress_huff_cache* cache)
+{
+	const size_t n = cache->n_buckets * 2;
+	if (cache->stats.memory + cache->n_buckets * sizeof(xhc_entry*) > cache->memory_limit) { return; }
+	xhc_entry** buckets = (xhc_entry**)calloc(n, sizeof(xhc_entry*));
+	if (buckets == NULL) { return; }
+	for (size_t i = 0; i < cache->n_buckets; ++i)
+	{
+		for (xhc_entry* e = cache->buckets[i], *chain; e; e = chain)
+		{
+			chain = e->chain;
+			e->chain = buckets[e->hash & (n - 1)];
+			buckets[e->hash & (n - 1)] = e;
+		}
+	}
+	free(cache->buckets);
+	cache->stats.memory += cache->n_buckets * sizeof(xhc_entry*);
+	cache->buckets = buckets;
+	cache->n_buckets = n;
+}
+
+xpress_huff_cache* xpress_huff_cache_new(size_t memory_limit)
+{
+	xpress_huff_cache* cache = (xpress_huff_cache*)calloc(1, sizeof(xpress_huff_cache));
+	if (cache == NULL) { return NULL; }
+	cache->ctx = xpress_huff_ctx_new();
+	cache->buckets = (xhc_entry**)calloc(MIN_BUCKETS, sizeof(xhc_entry*));
+	if (cache->ctx == NULL || cache->buckets == NULL) { xpress_huff_cache_free(cache); return NULL; }
+	cache->n_buckets = MIN_BUCKETS;
+	cache->memory_limit = memory_limit;
+	cache->stats.memory = MIN_BUCKETS * sizeof(xhc_entry*);
+	return cache;
+}
+
+void xpress_huff_cache_clear(xpress_huff_cache* cache)
+{
+	while (cache->head) { xhc_remove(cache, cache->head); }
+}
+
+void xpress_huff_cache_free(xpress_huff_cache* cache)
+{
+	if (cache)
+	{
+		if (cache->buckets) { xpress_huff_cache_clear(cache); }
+		free(cache->buckets);
+		xpress_huff_ctx_free(cache->ctx);
+		free(cache);
+	}
+}
+
+void xpress_huff_cache_get_stats(const xpress_huff_cache* cache, xpress_huff_cache_stats* stats)
+{
+	*stats = cache->stats;
+}
+
+int xpress_huff_cache_compress(xpress_huff_cache* cache, int level, const uint8_t* in, size_t in_len, uint8_t* out, size_t* out_len)
+{
+	if (level == 0) { level = XPRESS_HUFF_DEFAULT_LEVEL; }
+	int err = xpress_huff_ctx_set_level(cache->ctx, level);
+	if (err) { return err; }
+
+	////////// Look up the input //////////
+	const uint64_t hash = xhc_hash(in, in_len);
+	for (xhc_entry* e = cache->buckets[hash & (cache->n_buckets - 1)]; e; e = e->chain)
+	{
+		if (e->hash == hash && e->level == level && e->in_len == in_len && memcmp(e->data, in, in_len) == 0)
+		{
+			++cache->stats.hits;
+			xhc_unlink(cache, e);
+			xhc_push_front(cache, e);
+			if (*out_len < e->out_len) { return ENOBUFS; }
+			memcpy(out, e->data + in_len, e->out_len);
+			*out_len = e->out_len;
+			return 0;
+		}
+	}
+
+	////////// Compress and remember the result //////////
+	++cache->stats.misses;
+	if ((err = xpress_huff_compress_ctx(cache->ctx, in, in_len, out, out_len, NULL)) != 0) { return err; }
+	const size_t size = xhc_entry_size(in_len, *out_len), table = cache->n_buckets * sizeof(xhc_entry*);
+	if (table > cache->memory_limit || size > cache->memory_limit - table) { return 0; }
+	while (cache->tail && cache->stats.memory + size > cache->memory_limit)
+	{
+		xhc_remove(cache, cache->tail);
+		++cache->stats.evictions;
+	}
+	xhc_entry* e = (xhc_entry*)malloc(size);
+	if (e == NULL) { return 0; } // the output is fine, it just is not cached
+	e->hash = hash;
+	e->level = level;
+	e->in_len = in_len;
+	e->out_len = *out_len;
+	memcpy(e->data, in, in_len);
+	memcpy(e->data + in_len, out, *out_len);
+	xhc_entry** bucket = &cache->buckets[hash & (cache->n_buckets - 1)];
+	e->chain = *bucket;
+	*bucket = e;
+	xhc_push_front(cache, e);
+	cache->stats.memory += size;
+	if (++cache->stats.entries > cache->n_buckets) { xhc_grow(cache); }
+	return 0;
+}
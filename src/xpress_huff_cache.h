@@ -0,0 +1,63 @@
+// ms-compress: implements Microsoft compression algorithms
+// Copyright (C) 2018 David Mulder <dmulder@suse.com>
+//
+// This library is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This library is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+
+////////////////////////////// Compression Result Cache ////////////////////////////////////////////
+// A bounded cache of Xpress Huffman compression results, for servers that compress the same data
+// over and over (like hot file blocks). Results are looked up by a 64-bit hash of the input and the
+// level, and the cached input is compared with the new one before its output is used, so a hash
+// collision only costs a recompression. When the memory limit is reached the least recently used
+// results are dropped.
+// All functions that return int return 0 on success or an errno value:
+//   ENOMEM   an allocation failed
+//   EINVAL   an argument is out of range
+//   ENOBUFS  the output buffer is too small (see xpress_huff_max_compressed_size)
+
+#ifndef MSCOMP_XPRESS_HUFF_CACHE_H
+#define MSCOMP_XPRESS_HUFF_CACHE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// A cache holds its own compression context. A cache may be used for any number of calls, but only
+// by one thread at a time.
+typedef struct _xpress_huff_cache xpress_huff_cache;
+
+typedef struct
+{
+	uint64_t hits, misses;
+	uint64_t evictions;     // results dropped to stay within the memory limit
+	size_t entries, memory; // the results cached now and the memory they (and the lookup table) use
+} xpress_huff_cache_stats;
+
+// Creates a cache that uses at most memory_limit bytes for cached results (inputs and outputs are
+// both kept) and frees one. Returns NULL if out of memory.
+xpress_huff_cache* xpress_huff_cache_new(size_t memory_limit);
+void xpress_huff_cache_free(xpress_huff_cache* cache);
+
+// Drops all cached results, the statistics are kept
+void xpress_huff_cache_clear(xpress_huff_cache* cache);
+
+// Compresses in into out like xpress_huff_compress at the given level (0 for the default), returning
+// the cached output when the same input was compressed at the same level before. On input *out_len
+// is the size of out, on success it is set to the number of bytes written. Inputs too large to be
+// cached within the memory limit are compressed every time.
+int xpress_huff_cache_compress(xpress_huff_cache* cache, int level, const uint8_t* in, size_t in_len, uint8_t* out, size_t* out_len);
+
+// Gets the hit and miss counts and memory use of the cache
+void xpress_huff_cache_get_stats(const xpress_huff_cache* cache, xpress_huff_cache_stats* stats);
+
+#endif
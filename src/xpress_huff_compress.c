@@ -21,9 +21,17 @@
 #include <stdio.h>
 #include <stddef.h>
 #include <stdint.h>
-#include "XpressDictionary.h"
+#include <time.h>
+#if defined(MSCOMP_WITH_TIMING) && (defined(__x86_64__) || defined(__i386__))
+#include <x86intrin.h>
+#endif
+#if defined(__linux__)
+#include <sys/mman.h>
+#endif
+#include "xpress_huff_compress.h"
+#include "xpress_huff_internal.h"
 #include "Bitstream.h"
-#include "HuffmanEncoder.h"
+#include "Crc32c.h"
 
 #define MIN(a, b) (((a) < (b)) ? (a) : (b))
 
@@ -32,25 +40,25 @@
 ////////////////////////////// General Definitions and Functions ///////////////////////////////////
 #define CHUNK_SIZE		0x10000
 
-#define STREAM_END		0x100
 #define STREAM_END_LEN_1	1
 
 #define SYMBOLS			0x200
 #define HALF_SYMBOLS	0x100
 
-#define MIN_DATA		HALF_SYMBOLS + 4 // the 512 Huffman lens + 2 uint16s for minimal bitstream
+#define MIN_DATA		(HALF_SYMBOLS + 4) // the 512 Huffman lens + 2 uint16s for minimal bitstream
 
 size_t xpress_huff_max_compressed_size(size_t in_len) { return in_len + 34 + (HALF_SYMBOLS + 2) + (HALF_SYMBOLS + 2) * (in_len / CHUNK_SIZE); }
+uint64_t xpress_huff_chunk_count(uint64_t size) { return size / CHUNK_SIZE + (size % CHUNK_SIZE != 0); } // adding CHUNK_SIZE - 1 could wrap
 
 
 ////////////////////////////// Compression Functions ///////////////////////////////////////////////
-static size_t xh_compress_lz77(const uint8_t* in, int32_t /* * */ in_len, const uint8_t* in_end, uint8_t* out, uint32_t symbol_counts[SYMBOLS], XpressDictionary* d)
+size_t xh_compress_lz77(const uint8_t* in, int32_t /* * */ in_len, int is_end, uint8_t* out, uint32_t symbol_counts[SYMBOLS], XpressDictionary* d)
 {
 	int32_t rem = /* * */ in_len;
-	uint32_t mask;
-	const const uint8_t* in_orig = in, *out_orig = out;
-	uint32_t* mask_out;
-	uint8_t i;
+	uint32_t mask = 0;
+	const uint8_t* out_orig = out;
+	uint32_t* mask_out = (uint32_t*)out;
+	uint8_t i = 0;
 
 	Fill(d, in);
 	memset(symbol_counts, 0, SYMBOLS*sizeof(uint32_t));
@@ -119,7 +127,7 @@ static size_t xh_compress_lz77(const uint8_t* in, int32_t /* * */ in_len, const
 	// Set the total number of bytes read from in
 	/* *in_len -= rem; */
 	mask >>= (32-i); // finish moving the value over
-	if (in_orig+ /* * */ in_len == in_end)
+	if (is_end)
 	{
 		// Add the end of stream symbol
 		if (i == 32)
@@ -143,7 +151,7 @@ static size_t xh_compress_lz77(const uint8_t* in, int32_t /* * */ in_len, const
 	return out - out_orig;
 }
 
-static size_t xh_compress_no_matching(const uint8_t* in, size_t in_len, int is_end, uint8_t* out, uint32_t symbol_counts[SYMBOLS])
+size_t xh_compress_no_matching(const uint8_t* in, size_t in_len, int is_end, uint8_t* out, uint32_t symbol_counts[SYMBOLS])
 {
 	const const uint8_t* in_end = in + in_len, *in_endx = in_end - 32;
 	const const uint8_t* out_orig = out;
@@ -169,7 +177,7 @@ static size_t xh_compress_no_matching(const uint8_t* in, size_t in_len, int is_e
 	}
 	return out - out_orig;
 }
-static size_t xh_calc_compressed_len(const const uint8_t lens[SYMBOLS], const uint32_t symbol_counts[SYMBOLS], const size_t buf_len)
+size_t xh_calc_compressed_len(const const uint8_t lens[SYMBOLS], const uint32_t symbol_counts[SYMBOLS], const size_t buf_len)
 {
 	size_t sym_bits = 16; // we always have at least an extra 16-bits of 0s as the "end-of-chunk"
 	uint32_t literal_syms = 0, match_syms = 0;
@@ -183,7 +191,7 @@ static size_t xh_calc_compressed_len_no_matching(const const uint8_t lens[SYMBOL
 	for (uint_fast16_t i = 0; i <= 0x100; ++i) { sym_bits += lens[i] * symbol_counts[i]; }
 	return (sym_bits+15)/16*2;
 }
-static void xh_compress_encode(const uint8_t* in, const const uint8_t* in_end, uint8_t* out, HuffmanEncoder *encoder)
+void xh_compress_encode(const uint8_t* in, const const uint8_t* in_end, uint8_t* out, HuffmanEncoder *encoder)
 {
 	// Write the encoded compressed data
 	// This involves parsing the LZ77 compressed data and re-writing it with the Huffman codes
@@ -236,88 +244,762 @@ static void xh_compress_encode(const uint8_t* in, const const uint8_t* in_end, u
 	Finish(&bstr); // make sure that the write stream is finished writing
 }
 
-int xpress_huff_compress(const uint8_t* in, size_t in_len, uint8_t* out, size_t* _out_len)
+////////////////////////////// Compression Levels //////////////////////////////////////////////////
+// The dictionary settings of each level. The default level (5) is the original fixed settings.
+static const struct
 {
-	if (in_len == 0) { *_out_len = 0; return 0; }
+	uint8_t hash_bits;
+	uint16_t max_chain, nice_length;
+} xh_levels[XPRESS_HUFF_MAX_LEVEL + 1] =
+{
+	{ 0,   0,     0 }, // not used
+	{ 12,  1,    16 },
+	{ 13,  2,    24 },
+	{ 14,  4,    32 },
+	{ 15,  8,    40 },
+	{ 15, 11,    48 },
+	{ 15, 24,    96 },
+	{ 16, 48,   192 },
+	{ 16, 128, 1024 },
+	{ 16, 512, 0xFFFF },
+};
+
+////////////////////////////// Preset Dictionaries ///////////////////////////////////////////////
+// A preset dictionary is data that is treated as if it came right before the input, so that matches
+// in the first chunk can refer to it. Only the last MAX_OFFSET bytes can be referred to. Since the
+// tables hold positions (see XpressDictionary.h) the hashes of the dictionary are calculated once and
+// copied into the tables of each compression instead of hashing the dictionary every time.
+//
+// When compressing, the dictionary is put right before the first chunk at the end of the first half
+// of the context's hist buffer (and the first chunk is copied to the second half), so its bytes are
+// at the positions POS_BIAS + CHUNK_SIZE - len to POS_BIAS + CHUNK_SIZE. They are hashed at those
+// positions so that the table entries and the window entries (which are the last len of a window of
+// CHUNK_SIZE*2) can be copied as is.
+//
+// A prepared dictionary is never changed after it is prepared, so any number of contexts (and
+// threads) can use it at once: each compression copies the table into its context and each context
+// copies the data and the window entries once, until something else overwrites them.
+struct _xpress_huff_dict
+{
+	size_t len;         // at most MAX_OFFSET
+	unsigned hash_bits; // the size of table, a compression with the dictionary always uses this
+	size_t size;        // bytes allocated for the dictionary, including this struct
+	uint8_t* data;
+	uint32_t* table;    // 1 << hash_bits entries
+	uint32_t* window;   // len entries
+};
+
+static xpress_huff_dict* xh_dict_prepare(const uint8_t* data, size_t len, unsigned hash_bits, const mscomp_allocator* allocator)
+{
+	if (len > MAX_OFFSET) { data += len - MAX_OFFSET; len = MAX_OFFSET; }
+	const size_t hash_size = (size_t)1 << hash_bits, size = sizeof(xpress_huff_dict) + (hash_size + len) * sizeof(uint32_t) + len;
+	xpress_huff_dict* dict = (xpress_huff_dict*)mscomp_alloc(allocator, size);
+	if (dict == NULL) { return NULL; }
+	dict->len = len;
+	dict->hash_bits = hash_bits;
+	dict->size = size;
+	dict->table = (uint32_t*)(dict + 1);
+	dict->window = dict->table + hash_size;
+	dict->data = (uint8_t*)(dict->window + len);
+	memcpy(dict->data, data, len);
+
+	// Hash the data on its own, where the positions are POS_BIAS to POS_BIAS + len and (since POS_BIAS
+	// is a multiple of the window size) the window entries are 0 to len (the last 2 are never written)
+	XpressDictionary d;
+	XpressDictionary_empty(&d, NULL);
+	XpressDictionary_place(&d, hash_bits, len, dict->table);
+	XpressDictionary_reset(&d, dict->data, dict->data + len);
+	memset(dict->window, 0, len * sizeof(uint32_t));
+	Add2(&d, dict->data, len);
+
+	// Then move the positions to where the data is when compressing
+	const uint32_t shift = (uint32_t)(CHUNK_SIZE - len);
+	for (size_t i = 0; i < hash_size; ++i) { if (dict->table[i]) { dict->table[i] += shift; } }
+	for (size_t i = 0; i < len; ++i) { if (dict->window[i]) { dict->window[i] += shift; } }
+	return dict;
+}
 
-	uint8_t* buf = (uint8_t*)malloc((in_len >= CHUNK_SIZE) ? 0x1200C : ((in_len + 31) / 32 * 36 + 4 + 8)); // for every 32 bytes in "in" we need up to 36 bytes in the temp buffer + maybe an extra uint32 length symbol + up to 7 for the EOS (+1 for alignment)
-	if (buf == NULL) { return ENOMEM; }
-	
-	const uint8_t* out_orig = out;
-	const const uint8_t* in_end = in+in_len;
-	size_t out_len = *_out_len;
+static void xh_dict_free(xpress_huff_dict* dict, const mscomp_allocator* allocator)
+{
+	mscomp_free(allocator, dict);
+}
+
+xpress_huff_dict* xpress_huff_dict_prepare(const uint8_t* data, size_t len, int level)
+{
+	if (level < XPRESS_HUFF_MIN_LEVEL || level > XPRESS_HUFF_MAX_LEVEL) { level = XPRESS_HUFF_DEFAULT_LEVEL; }
+	return len ? xh_dict_prepare(data, len, xh_levels[level].hash_bits, NULL) : NULL;
+}
+
+void xpress_huff_dict_free(xpress_huff_dict* dict) { xh_dict_free(dict, NULL); }
+
+////////////////////////////// Compression Context /////////////////////////////////////////////////
+// The effort a chunk gets, lowered when the chunks would not finish within the time budget
+#define XH_EFFORT_LEVEL			0 // the match search settings of the level
+#define XH_EFFORT_FAST			1 // the match search settings of the fastest level
+#define XH_EFFORT_NO_MATCHING	2 // only literals (like xh_compress_no_matching for chunks that do not compress)
+
+// Everything a compression needs besides the input and output. Reusing a context across calls avoids
+// allocating the dictionary (~768 KiB for large inputs) and the LZ77 buffer on every call.
+struct _xpress_huff_ctx
+{
 	XpressDictionary d;
 	HuffmanEncoder encoder;
 	uint32_t symbol_counts[SYMBOLS]; // 4*512 = 2 kb
-	XpressDictionary_init(&d, in, in_end);
+	uint8_t* buf;
+	size_t buf_size;
+	int level;
+	int adaptive_chain; // the dictionary adapts the chain depth (see XpressDictionary_adapt)
+	int match_costs; // the dictionary picks matches by their cost in costs (see xh_update_costs)
+	uint8_t costs[SYMBOLS];
+	size_t memory_limit; // 0 for no limit
+	mscomp_allocator allocator; // everything the context allocates, including itself
+
+	// With huge pages the dictionary tables and the LZ77 buffer share one 2 MiB aligned block
+	int huge_pages;
+	void* huge;
+	size_t huge_size;
+
+	// The preset dictionary and the buffer the first chunk is compressed in when there is one (see
+	// xh_ctx_load_dict), along with the dictionaries whose data is in hist and whose window entries
+	// are in the window so they are only copied again when something else overwrote them
+	const xpress_huff_dict* dict;
+	xpress_huff_dict* own_dict; // the dictionary prepared by xpress_huff_ctx_set_dict, freed with the context
+	uint8_t* hist; // CHUNK_SIZE*2 bytes
+	const xpress_huff_dict* hist_dict;
+	const xpress_huff_dict* window_dict;
+
+	// The XPRESS_HUFF_CHECKSUM_* flags and the CRC32Cs of the input and output of the last compression
+	unsigned checksums;
+	uint32_t in_crc, out_crc;
+
+	// The time each compression may take in ns (0 for no limit) and the effort the chunks of the
+	// current compression get because of it (see xh_check_budget)
+	uint64_t time_budget;
+	int effort;
+
+	// The speed to hold in MB/s (0 for none) and the level whose match search the next chunk gets for
+	// it, which carries over to the next compression (0 until the first one), along with a level that
+	// was too slow and the chunks left before it is tried again (see xh_adapt_speed)
+	uint32_t target_speed;
+	int speed_level, slow_level;
+	uint32_t slow_chunks;
+
+	// Per-stage timing (only used when compiled with MSCOMP_WITH_TIMING)
+	uint32_t chunk; // index of the chunk being compressed
+	uint64_t stage_cycles[XPRESS_HUFF_STAGES];
+	xpress_huff_trace_fn trace;
+	void* trace_data;
+};
+
+static void xh_ctx_init(xpress_huff_ctx* ctx, const mscomp_allocator* allocator)
+{
+	if (allocator && allocator->alloc) { ctx->allocator = *allocator; }
+	else { ctx->allocator.alloc = NULL; ctx->allocator.free = NULL; ctx->allocator.opaque = NULL; }
+	ctx->buf = NULL;
+	ctx->buf_size = 0;
+	ctx->level = XPRESS_HUFF_DEFAULT_LEVEL;
+	ctx->adaptive_chain = 0;
+	ctx->match_costs = 0;
+	ctx->memory_limit = 0;
+	ctx->huge_pages = 0;
+	ctx->huge = NULL;
+	ctx->huge_size = 0;
+	ctx->dict = NULL;
+	ctx->own_dict = NULL;
+	ctx->hist = NULL;
+	ctx->hist_dict = NULL;
+	ctx->window_dict = NULL;
+	ctx->checksums = 0;
+	ctx->in_crc = 0;
+	ctx->out_crc = 0;
+	ctx->time_budget = 0;
+	ctx->effort = XH_EFFORT_LEVEL;
+	ctx->target_speed = 0;
+	ctx->speed_level = 0;
+	ctx->slow_level = XPRESS_HUFF_MAX_LEVEL + 1;
+	ctx->slow_chunks = 0;
+	XpressDictionary_empty(&ctx->d, &ctx->allocator);
+	ctx->chunk = 0;
+	memset(ctx->stage_cycles, 0, sizeof(ctx->stage_cycles));
+	ctx->trace = NULL;
+	ctx->trace_data = NULL;
+}
+
+static void xh_huge_free(void* p);
+
+static void xh_ctx_destroy(xpress_huff_ctx* ctx)
+{
+	XpressDictionary_free(&ctx->d);
+	if (ctx->huge) { xh_huge_free(ctx->huge); ctx->huge = NULL; ctx->huge_size = 0; }
+	else { mscomp_free(&ctx->allocator, ctx->buf); }
+	ctx->buf = NULL;
+	ctx->buf_size = 0;
+	mscomp_free(&ctx->allocator, ctx->hist);
+	ctx->hist = NULL;
+	ctx->hist_dict = NULL;
+	ctx->window_dict = NULL;
+}
 
-	// Go through each chunk except the last
-	while (in_len > CHUNK_SIZE)
+xpress_huff_ctx* xpress_huff_ctx_new_with_allocator(const mscomp_allocator* allocator)
+{
+	xpress_huff_ctx* ctx = (xpress_huff_ctx*)mscomp_alloc(allocator, sizeof(xpress_huff_ctx));
+	if (ctx) { xh_ctx_init(ctx, allocator); }
+	return ctx;
+}
+
+xpress_huff_ctx* xpress_huff_ctx_new(void) { return xpress_huff_ctx_new_with_allocator(NULL); }
+
+void xpress_huff_ctx_free(xpress_huff_ctx* ctx)
+{
+	if (ctx)
 	{
-		////////// Perform the initial LZ77 compression //////////
-		size_t buf_len = xh_compress_lz77(in, CHUNK_SIZE, in_end, buf, symbol_counts, &d);
-
-		////////// Create the Huffman codes/lens and Calculate the compressed output size //////////
-		const uint8_t* lens = CreateCodes(&encoder, symbol_counts);
-		size_t comp_len = xh_calc_compressed_len(lens, symbol_counts, buf_len);
-		
-		////////// Guarantee Max Compression Size //////////
-		// This is required to guarantee max compressed size
-		// It is very rare that it is used (mainly medium-high uncompressible data)
-		if (comp_len > CHUNK_SIZE+2) // + 2 for alignment
+		const mscomp_allocator allocator = ctx->allocator;
+		xh_ctx_destroy(ctx);
+		xh_dict_free(ctx->own_dict, &allocator);
+		mscomp_free(&allocator, ctx);
+	}
+}
+
+int xpress_huff_ctx_set_level(xpress_huff_ctx* ctx, int level)
+{
+	if (level == 0) { level = XPRESS_HUFF_DEFAULT_LEVEL; }
+	if (level < XPRESS_HUFF_MIN_LEVEL || level > XPRESS_HUFF_MAX_LEVEL) { return EINVAL; }
+	ctx->level = level;
+	return 0;
+}
+
+void xpress_huff_ctx_set_adaptive_chain(xpress_huff_ctx* ctx, int enable)
+{
+	ctx->adaptive_chain = enable;
+}
+
+void xpress_huff_ctx_set_match_costs(xpress_huff_ctx* ctx, int enable)
+{
+	ctx->match_costs = enable;
+}
+
+void xpress_huff_ctx_set_memory_limit(xpress_huff_ctx* ctx, size_t limit)
+{
+	ctx->memory_limit = limit;
+}
+
+int xpress_huff_ctx_set_dict(xpress_huff_ctx* ctx, const uint8_t* dict, size_t dict_len)
+{
+	xpress_huff_dict* prepared = NULL;
+	if (dict_len > 0 && (prepared = xh_dict_prepare(dict, dict_len, xh_levels[ctx->level].hash_bits, &ctx->allocator)) == NULL) { return ENOMEM; }
+	xpress_huff_ctx_use_dict(ctx, prepared);
+	ctx->own_dict = prepared;
+	return 0;
+}
+
+void xpress_huff_ctx_use_dict(xpress_huff_ctx* ctx, const xpress_huff_dict* dict)
+{
+	xh_dict_free(ctx->own_dict, &ctx->allocator);
+	ctx->own_dict = NULL;
+	ctx->dict = dict;
+	// A new dictionary could have been prepared where an old one was freed, so never trust the copies
+	ctx->hist_dict = NULL;
+	ctx->window_dict = NULL;
+}
+
+void xpress_huff_ctx_set_huge_pages(xpress_huff_ctx* ctx, int enable)
+{
+	ctx->huge_pages = enable && !ctx->allocator.alloc;
+}
+
+void xpress_huff_ctx_set_time_budget(xpress_huff_ctx* ctx, uint64_t ns)
+{
+	ctx->time_budget = ns;
+}
+
+void xpress_huff_ctx_set_target_speed(xpress_huff_ctx* ctx, uint32_t mb_per_sec)
+{
+	ctx->target_speed = mb_per_sec;
+	ctx->speed_level = 0;
+	ctx->slow_level = XPRESS_HUFF_MAX_LEVEL + 1;
+	ctx->slow_chunks = 0;
+}
+
+void xpress_huff_ctx_set_checksums(xpress_huff_ctx* ctx, unsigned checksums)
+{
+	ctx->checksums = checksums;
+}
+
+void xpress_huff_ctx_get_checksums(const xpress_huff_ctx* ctx, uint32_t* in_crc, uint32_t* out_crc)
+{
+	if (in_crc) { *in_crc = ctx->in_crc; }
+	if (out_crc) { *out_crc = ctx->out_crc; }
+}
+
+uint32_t xpress_huff_crc32c(uint32_t crc, const uint8_t* data, size_t len) { return Crc32c(crc, data, len); }
+
+void xpress_huff_ctx_set_trace(xpress_huff_ctx* ctx, xpress_huff_trace_fn trace, void* data)
+{
+	ctx->trace = trace;
+	ctx->trace_data = data;
+}
+
+////////////////////////////// Memory Usage ////////////////////////////////////////////////////////
+// for every 32 bytes in "in" we need up to 36 bytes in the temp buffer + maybe an extra uint32 length symbol + up to 7 for the EOS (+1 for alignment)
+static size_t xh_buf_size(size_t in_len) { return (in_len >= CHUNK_SIZE) ? 0x1200C : ((in_len + 31) / 32 * 36 + 4 + 8); }
+
+// The number of bytes the window has to cover for in_len bytes of input: with a preset dictionary the
+// first chunk is always at the start of the second half of a window of CHUNK_SIZE*2
+static size_t xh_window_len(const xpress_huff_ctx* ctx, size_t in_len) { return ctx->dict ? CHUNK_SIZE << 1 : in_len; }
+
+// The size of the huge page block holding the dictionary tables and the LZ77 buffer
+#define HUGE_PAGE_SIZE	0x200000
+static size_t xh_huge_size(unsigned hash_bits, size_t in_len, size_t window_len)
+{
+	return (XpressDictionary_memory(hash_bits, window_len) + xh_buf_size(in_len) + HUGE_PAGE_SIZE - 1) & ~(size_t)(HUGE_PAGE_SIZE - 1);
+}
+
+// The most memory allocated at once by a compression of in_len bytes with a new context, including
+// the context itself
+static size_t xh_memory_usage(unsigned hash_bits, size_t in_len, size_t window_len, int huge)
+{
+	if (in_len == 0) { return sizeof(xpress_huff_ctx); }
+	return sizeof(xpress_huff_ctx) + (huge ? xh_huge_size(hash_bits, in_len, window_len) : xh_buf_size(in_len) + XpressDictionary_memory(hash_bits, window_len));
+}
+
+size_t xpress_huff_memory_usage(int level, unsigned threads, size_t in_len)
+{
+	if (level < XPRESS_HUFF_MIN_LEVEL || level > XPRESS_HUFF_MAX_LEVEL) { level = XPRESS_HUFF_DEFAULT_LEVEL; }
+	return xh_memory_usage(xh_levels[level].hash_bits, in_len, in_len, 0) * threads;
+}
+
+unsigned xpress_huff_threads_for_memory(unsigned threads, size_t in_len, size_t limit)
+{
+	// Each thread can go down to the smallest hash table before there have to be fewer threads
+	const size_t min_usage = xh_memory_usage(MIN_HASH_BITS, in_len, in_len, 0);
+	while (threads > 0 && min_usage * threads > limit) { --threads; }
+	return threads;
+}
+
+// Chooses the hash table size for compressing in_len bytes with ctx, making it smaller than the
+// level's if needed to stay within the memory limit. Returns 0 if the limit cannot be met. With a
+// preset dictionary the size is the dictionary's and hist (and the dictionary if the context owns it)
+// are counted as well.
+static unsigned xh_ctx_hash_bits(xpress_huff_ctx* ctx, size_t in_len)
+{
+	const size_t window_len = xh_window_len(ctx, in_len), extra = ctx->dict ? (CHUNK_SIZE << 1) + (ctx->own_dict ? ctx->own_dict->size : 0) : 0;
+	unsigned hash_bits = ctx->dict ? ctx->dict->hash_bits : xh_levels[ctx->level].hash_bits;
+	if (ctx->memory_limit == 0) { return hash_bits; }
+	while (!ctx->dict && hash_bits > MIN_HASH_BITS && xh_memory_usage(hash_bits, in_len, window_len, ctx->huge_pages) + extra > ctx->memory_limit) { --hash_bits; }
+	if (xh_memory_usage(hash_bits, in_len, window_len, ctx->huge_pages) + extra > ctx->memory_limit) { return 0; }
+
+	// Buffers kept from a larger earlier call could put it over the limit, so only keep what is needed
+	if (ctx->huge ? ctx->huge_size > xh_huge_size(hash_bits, in_len, window_len) :
+		(ctx->buf_size > xh_buf_size(in_len) || ctx->d.WindowCap > XpressDictionary_window_size(window_len))) { xh_ctx_destroy(ctx); }
+	if (!ctx->dict && ctx->hist) { mscomp_free(&ctx->allocator, ctx->hist); ctx->hist = NULL; ctx->hist_dict = NULL; }
+	return hash_bits;
+}
+
+////////////////////////////// Huge Pages //////////////////////////////////////////////////////////
+// The dictionary is accessed randomly over more than 1 MiB, which causes many dTLB misses with 4 KiB
+// pages. With huge pages enabled the tables and the LZ77 buffer are put in a single 2 MiB aligned
+// block that the kernel is asked to back with transparent huge pages. If the block cannot be
+// allocated the normal allocations are used instead.
+static void* xh_huge_alloc(size_t size)
+{
+#if defined(__unix__) || defined(__APPLE__)
+	void* p;
+	if (posix_memalign(&p, HUGE_PAGE_SIZE, size) != 0) { return NULL; }
+#ifdef MADV_HUGEPAGE
+	madvise(p, size, MADV_HUGEPAGE); // only a hint, if it fails the block is still usable
+#endif
+	return p;
+#else
+	return NULL;
+#endif
+}
+
+static void xh_huge_free(void* p)
+{
+	(free)(p); // posix_memalign memory, never from a replaced malloc
+}
+
+// Places the dictionary and the LZ77 buffer in the huge page block, returns 0 if it is not available
+static int xh_ctx_alloc_huge(xpress_huff_ctx* ctx, unsigned hash_bits, size_t in_len, size_t window_len)
+{
+	const size_t size = xh_huge_size(hash_bits, in_len, window_len);
+	if (ctx->huge_size < size)
+	{
+		xh_ctx_destroy(ctx);
+		if ((ctx->huge = xh_huge_alloc(size)) == NULL) { return 0; }
+		ctx->huge_size = size;
+	}
+	XpressDictionary_place(&ctx->d, hash_bits, window_len, ctx->huge);
+	ctx->buf = (uint8_t*)ctx->huge + XpressDictionary_memory(hash_bits, window_len);
+	ctx->buf_size = xh_buf_size(in_len);
+	return 1;
+}
+
+// Makes sure the dictionary, the LZ77 buffer and (with a preset dictionary) hist are large enough for
+// in_len bytes
+static int xh_ctx_alloc(xpress_huff_ctx* ctx, unsigned hash_bits, size_t in_len)
+{
+	const size_t window_len = xh_window_len(ctx, in_len);
+	if (!(ctx->huge_pages && xh_ctx_alloc_huge(ctx, hash_bits, in_len, window_len)))
+	{
+		if (ctx->huge) { xh_ctx_destroy(ctx); }
+		const size_t buf_size = xh_buf_size(in_len);
+		if (ctx->buf_size < buf_size)
 		{
-			buf_len = xh_compress_no_matching(in, CHUNK_SIZE, 0, buf, symbol_counts);
-			lens = CreateCodesSlow(&encoder, symbol_counts);
-			comp_len = xh_calc_compressed_len_no_matching(lens, symbol_counts);
+			mscomp_free(&ctx->allocator, ctx->buf);
+			ctx->buf_size = 0;
+			if ((ctx->buf = (uint8_t*)mscomp_alloc(&ctx->allocator, buf_size)) == NULL) { return ENOMEM; }
+			ctx->buf_size = buf_size;
 		}
+		const uint32_t* window = ctx->d.window;
+		if (XpressDictionary_alloc(&ctx->d, hash_bits, window_len) != 0) { return ENOMEM; }
+		if (ctx->d.window != window) { ctx->window_dict = NULL; }
+	}
+	if (ctx->dict && !ctx->hist && (ctx->hist = (uint8_t*)mscomp_alloc(&ctx->allocator, CHUNK_SIZE << 1)) == NULL) { return ENOMEM; }
+	return 0;
+}
+
+////////////////////////////// Stage Timing ////////////////////////////////////////////////////////
+// With MSCOMP_WITH_TIMING each stage of each chunk is timed, the cycles are added to the stats and
+// passed to the trace function of the context. Without it XH_TIME_STAGE is just the statement.
+#ifdef MSCOMP_WITH_TIMING
+static uint64_t xh_cycles(void)
+{
+#if defined(__x86_64__) || defined(__i386__)
+	return __rdtsc();
+#elif defined(__aarch64__)
+	uint64_t x;
+	__asm__ __volatile__("mrs %0, cntvct_el0" : "=r"(x));
+	return x;
+#else
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000u + (uint64_t)ts.tv_nsec;
+#endif
+}
+static void xh_stage_done(xpress_huff_ctx* ctx, xpress_huff_stage stage, uint64_t cycles)
+{
+	ctx->stage_cycles[stage] += cycles;
+	if (ctx->trace) { ctx->trace(ctx->trace_data, ctx->chunk, stage, cycles); }
+}
+#define XH_TIME_STAGE(ctx, stage, ...) { const uint64_t _start = xh_cycles(); __VA_ARGS__; xh_stage_done(ctx, stage, xh_cycles() - _start); }
+#else
+#define XH_TIME_STAGE(ctx, stage, ...) { __VA_ARGS__; }
+#endif
+
+////////////////////////////// Statistics ////////////////////////////////////////////////////////
+static void xh_stats_reset(xpress_huff_stats* stats)
+{
+	xpress_huff_chunk_stats* const chunk_stats = stats->chunk_stats;
+	const size_t chunk_stats_cap = stats->chunk_stats_cap;
+	memset(stats, 0, sizeof(xpress_huff_stats));
+	stats->chunk_stats = chunk_stats;
+	stats->chunk_stats_cap = chunk_stats_cap;
+}
+
+// Adds a chunk that was just written with the symbol counts and Huffman codes currently in ctx
+static void xh_stats_add_chunk(xpress_huff_ctx* ctx, xpress_huff_stats* stats, size_t in_len, size_t out_len, const int fallback, const int is_end)
+{
+	const uint32_t* symbol_counts = ctx->symbol_counts;
+	const uint8_t* lens = ctx->encoder.lens;
+	XpressDictionary* d = &ctx->d;
+	xpress_huff_chunk_stats c;
+	c.in_len = in_len;
+	c.out_len = out_len;
+	c.literals = 0;
+	c.matches = 0;
+	c.max_code_len = 0;
+	for (uint_fast16_t i = 0; i < 0x100; ++i) { c.literals += symbol_counts[i]; }
+	for (uint_fast16_t i = 0x100; i < SYMBOLS; ++i)
+	{
+		// the match symbol holds the offset's highest bit in the upper nibble and the length - 3 (up to 15) in the lower
+		// the end of stream symbol is the same as a match with offset 1 and length 3
+		const uint32_t n = symbol_counts[i] - (i == STREAM_END && is_end);
+		c.matches += n;
+		stats->match_len_hist[i & 0xF] += n;
+		stats->offset_bits_hist[(i >> 4) & 0xF] += n;
+	}
+	for (uint_fast16_t i = 0; i < SYMBOLS; ++i) { if (lens[i] > c.max_code_len) { c.max_code_len = lens[i]; } }
+	c.finds = d->FindCount;
+	c.chain_steps = d->ChainSteps;
+	c.nice_hits = d->NiceHits;
+	c.fallback = (uint8_t)fallback;
+	d->FindCount = d->ChainSteps = d->NiceHits = 0;
+	for (uint_fast8_t i = 0; i < XPRESS_HUFF_STAGES; ++i)
+	{
+		c.cycles[i] = ctx->stage_cycles[i];
+		stats->cycles[i] += c.cycles[i];
+		ctx->stage_cycles[i] = 0;
+	}
+
+	stats->in_len += c.in_len;
+	stats->out_len += c.out_len;
+	stats->literals += c.literals;
+	stats->matches += c.matches;
+	stats->finds += c.finds;
+	stats->chain_steps += c.chain_steps;
+	stats->nice_hits += c.nice_hits;
+	stats->fallback_chunks += c.fallback;
+	if (c.max_code_len > stats->max_code_len) { stats->max_code_len = c.max_code_len; }
+	if (stats->chunk_stats && stats->chunks < stats->chunk_stats_cap) { stats->chunk_stats[stats->chunks] = c; }
+	++stats->chunks;
+}
+
+// Sets the symbol costs of the next chunk's match search to this chunk's Huffman code lengths
+#define INITIAL_COST	9 // bits of each symbol before the first chunk, as if all 512 were equally likely
+static void xh_update_costs(xpress_huff_ctx* ctx, const uint8_t* lens, const uint32_t symbol_counts[SYMBOLS])
+{
+	uint64_t bits = 0, literals = 0;
+	for (uint_fast16_t i = 0; i < SYMBOLS; ++i) { ctx->costs[i] = lens[i] ? lens[i] : HUFF_BITS_MAX; }
+	for (uint_fast16_t i = 0; i < 0x100; ++i) { bits += (uint64_t)symbol_counts[i] * lens[i]; literals += symbol_counts[i]; }
+	ctx->d.LiteralCost = literals ? (uint32_t)((bits << 4) / literals) : INITIAL_COST << 4;
+}
+
+// Compresses a single chunk of at most CHUNK_SIZE bytes, is_end is set for the last chunk
+// On success *comp_len is set to the number of bytes written to out
+static int xh_compress_chunk(xpress_huff_ctx* ctx, const uint8_t* in, size_t in_len, const int is_end, uint8_t* out, size_t out_len, size_t* _comp_len, xpress_huff_stats* stats)
+{
+	uint8_t* buf = ctx->buf;
+	uint32_t* symbol_counts = ctx->symbol_counts;
+	HuffmanEncoder* encoder = &ctx->encoder;
+	size_t buf_len, comp_len;
+	const uint8_t* lens;
+
+	////////// Perform the initial LZ77 compression //////////
+	// Unless there is no time left for finding matches
+	const int no_matching = ctx->effort == XH_EFFORT_NO_MATCHING;
+	if (no_matching) { XH_TIME_STAGE(ctx, XPRESS_HUFF_STAGE_LZ77, buf_len = xh_compress_no_matching(in, in_len, is_end, buf, symbol_counts)); }
+	else { XH_TIME_STAGE(ctx, XPRESS_HUFF_STAGE_LZ77, buf_len = xh_compress_lz77(in, (int32_t)in_len, is_end, buf, symbol_counts, &ctx->d)); }
+
+	// The chunk was just read by the LZ77 pass, so checksumming it now reads it from the cache
+	if (ctx->checksums & XPRESS_HUFF_CHECKSUM_INPUT) { XH_TIME_STAGE(ctx, XPRESS_HUFF_STAGE_LZ77, ctx->in_crc = Crc32c(ctx->in_crc, in, in_len)); }
+
+	////////// Create the Huffman codes/lens and Calculate the compressed output size //////////
+	XH_TIME_STAGE(ctx, XPRESS_HUFF_STAGE_CODES, lens = CreateCodes(encoder, symbol_counts));
+	XH_TIME_STAGE(ctx, XPRESS_HUFF_STAGE_LENGTH, comp_len = no_matching ? xh_calc_compressed_len_no_matching(lens, symbol_counts) : xh_calc_compressed_len(lens, symbol_counts, buf_len));
+
+	////////// Guarantee Max Compression Size //////////
+	// This is required to guarantee max compressed size
+	// It is very rare that it is used (mainly medium-high uncompressible data)
+	// The last chunk gets +36 for alignment and end of stream (because it causes a different symbol to need 9 bits), others +2 for alignment
+	const int fallback = comp_len > in_len + (is_end ? 36 : 2);
+	if (fallback)
+	{
+		if (!no_matching) { XH_TIME_STAGE(ctx, XPRESS_HUFF_STAGE_LZ77, buf_len = xh_compress_no_matching(in, in_len, is_end, buf, symbol_counts)); }
+		XH_TIME_STAGE(ctx, XPRESS_HUFF_STAGE_CODES, lens = CreateCodesSlow(encoder, symbol_counts));
+		XH_TIME_STAGE(ctx, XPRESS_HUFF_STAGE_LENGTH, comp_len = xh_calc_compressed_len_no_matching(lens, symbol_counts));
+	}
+	if (ctx->d.Costs) { xh_update_costs(ctx, lens, symbol_counts); }
+
+	////////// Output Huffman prefix codes as lengths and Encode compressed data //////////
+	if (out_len < HALF_SYMBOLS + comp_len) { PRINT_ERROR("Xpress Huffman Compression Error: Insufficient buffer\n"); return ENOBUFS; }
+	uint8_t* const out_chunk = out;
+	for (const const uint8_t* end = lens + SYMBOLS; lens < end; lens += 2) { *out++ = lens[0] | (lens[1] << 4); }
+	XH_TIME_STAGE(ctx, XPRESS_HUFF_STAGE_ENCODE, xh_compress_encode(buf, buf+buf_len, out, encoder));
+	if (ctx->checksums & XPRESS_HUFF_CHECKSUM_OUTPUT) { XH_TIME_STAGE(ctx, XPRESS_HUFF_STAGE_ENCODE, ctx->out_crc = Crc32c(ctx->out_crc, out_chunk, HALF_SYMBOLS + comp_len)); }
+	if (stats) { xh_stats_add_chunk(ctx, stats, in_len, HALF_SYMBOLS + comp_len, fallback, is_end); }
+	*_comp_len = HALF_SYMBOLS + comp_len;
+	return 0;
+}
 
-		////////// Output Huffman prefix codes as lengths and Encode compressed data //////////
-		if (out_len < HALF_SYMBOLS + comp_len) { PRINT_ERROR("Xpress Huffman Compression Error: Insufficient buffer\n"); free(buf); return ENOBUFS; }
-		for (const const uint8_t* end = lens + SYMBOLS; lens < end; lens += 2) { *out++ = lens[0] | (lens[1] << 4); }
-		xh_compress_encode(buf, buf+buf_len, out, &encoder);
-		in += CHUNK_SIZE; in_len -= CHUNK_SIZE;
-		out += comp_len; out_len -= HALF_SYMBOLS + comp_len;
+// Sets up the dictionary for the first chunk (len bytes of in) with the preset dictionary right
+// before it (see Preset Dictionaries) and returns where the chunk is to be compressed from
+static const uint8_t* xh_ctx_load_dict(xpress_huff_ctx* ctx, const uint8_t* in, size_t len)
+{
+	const xpress_huff_dict* dict = ctx->dict;
+	XpressDictionary* d = &ctx->d;
+	uint8_t* chunk = ctx->hist + CHUNK_SIZE;
+	if (ctx->hist_dict != dict) { memcpy(chunk - dict->len, dict->data, dict->len); ctx->hist_dict = dict; }
+	memcpy(chunk, in, len);
+	XpressDictionary_set_data(d, ctx->hist, chunk + len);
+	memcpy(d->table, dict->table, d->HashSize*sizeof(uint32_t));
+	if (ctx->window_dict != dict) { memcpy(d->window + (CHUNK_SIZE << 1) - dict->len, dict->window, dict->len*sizeof(uint32_t)); ctx->window_dict = dict; }
+
+	// The last 2 positions of the dictionary could not be hashed without the start of the input
+	const size_t n = MIN(2, dict->len);
+	Add2(d, chunk - n, n);
+	return chunk;
+}
+
+// Moves the start of the dictionary to the chunk before in, which keeps all of the positions that can
+// still be matched from in and after
+static void xh_ctx_rebase(xpress_huff_ctx* ctx, const uint8_t* in, const uint8_t* in_end)
+{
+	XpressDictionary_reset(&ctx->d, in - CHUNK_SIZE, in_end);
+	Fill(&ctx->d, in - CHUNK_SIZE);
+}
+
+static uint64_t xh_now_ns(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000u + (uint64_t)ts.tv_nsec;
+}
+
+// Checks the time budget before a chunk: when the remaining chunks would not finish in time if each
+// took chunk_ns like the last one, the effort is lowered a step (first to the match search of the
+// fastest level, then to no match search at all). The effort is never raised again within a compression.
+static void xh_check_budget(xpress_huff_ctx* ctx, uint64_t start, uint64_t chunk_ns, size_t chunks_left)
+{
+	const uint64_t elapsed = xh_now_ns() - start;
+	if (ctx->effort == XH_EFFORT_NO_MATCHING) { return; }
+	if (elapsed < ctx->time_budget && chunk_ns * chunks_left <= ctx->time_budget - elapsed) { return; }
+	if (elapsed < ctx->time_budget && ctx->effort == XH_EFFORT_LEVEL && ctx->level > XPRESS_HUFF_MIN_LEVEL)
+	{
+		ctx->effort = XH_EFFORT_FAST;
+		ctx->d.MaxChain = xh_levels[XPRESS_HUFF_MIN_LEVEL].max_chain;
+		ctx->d.NiceLength = xh_levels[XPRESS_HUFF_MIN_LEVEL].nice_length;
 	}
+	else { ctx->effort = XH_EFFORT_NO_MATCHING; }
+}
+
+// Adjusts the match search after a chunk of len bytes that took ns nanoseconds and compressed to
+// comp_len bytes to hold the target speed. The next chunk gets the match search of one level lower
+// when the chunk was slower than the target or barely compressed (searching harder would not find
+// anything anyway), or of one level higher when it was fast enough that the higher level likely
+// still keeps up. A level that turned out too slow is not tried again for SLOW_LEVEL_CHUNKS chunks so
+// the level does not flip between two every chunk. The hash table size stays that of the context's
+// level since the dictionary cannot change size within a compression.
+#define SPEED_HEADROOM		4  // a level higher is tried when the speed is 1/SPEED_HEADROOM above the target
+#define INCOMPRESSIBLE		32 // a chunk saving less than 1/INCOMPRESSIBLE of its size barely compressed
+#define SLOW_LEVEL_CHUNKS	16
+static void xh_adapt_speed(xpress_huff_ctx* ctx, size_t len, size_t comp_len, uint64_t ns)
+{
+	const uint64_t speed = ns ? (uint64_t)len * 1000 / ns : UINT64_MAX; // bytes per us is MB/s
+	int level = ctx->speed_level;
+	if (ctx->slow_chunks && --ctx->slow_chunks == 0) { ctx->slow_level = XPRESS_HUFF_MAX_LEVEL + 1; }
+	if (speed < ctx->target_speed)
+	{
+		if (level > XPRESS_HUFF_MIN_LEVEL) { ctx->slow_level = level--; ctx->slow_chunks = SLOW_LEVEL_CHUNKS; }
+	}
+	else if (comp_len >= len - len / INCOMPRESSIBLE) { if (level > XPRESS_HUFF_MIN_LEVEL) { --level; } }
+	else if (speed >= ctx->target_speed + ctx->target_speed / SPEED_HEADROOM && level + 1 < ctx->slow_level && level < XPRESS_HUFF_MAX_LEVEL) { ++level; }
+	ctx->speed_level = level;
+	ctx->d.MaxChain = xh_levels[level].max_chain;
+	ctx->d.NiceLength = xh_levels[level].nice_length;
+}
+
+// Writes the smallest possible last chunk (MIN_DATA bytes): a Huffman table where only the end of
+// stream symbol has a code, 1 bit long (so it is a 0 bit), and a bitstream of 0s
+static void xh_write_end_chunk(xpress_huff_ctx* ctx, uint8_t* out)
+{
+	memset(out, 0, MIN_DATA);
+	out[STREAM_END >> 1] = STREAM_END_LEN_1 << (4 * (STREAM_END & 1));
+	if (ctx->checksums & XPRESS_HUFF_CHECKSUM_OUTPUT) { ctx->out_crc = Crc32c(ctx->out_crc, out, MIN_DATA); }
+}
+
+// Compresses all of in, or with _in_used as many whole chunks as fit in out followed by an end chunk
+// (see xpress_huff_compress_partial)
+static int xh_compress(xpress_huff_ctx* ctx, const uint8_t* in, size_t in_len, uint8_t* out, size_t* _out_len, size_t* _in_used, xpress_huff_stats* stats)
+{
+	if (stats) { xh_stats_reset(stats); }
+	ctx->in_crc = ctx->out_crc = 0;
+	if (_in_used) { *_in_used = 0; }
+	if (in_len == 0) { *_out_len = 0; return 0; }
+
+	const unsigned hash_bits = xh_ctx_hash_bits(ctx, in_len);
+	if (hash_bits == 0) { return ENOMEM; }
 
-	// Do the last chunk
-	if (in_len == 0)
+	if (xh_ctx_alloc(ctx, hash_bits, in_len) != 0) { return ENOMEM; }
+	
+	const int timed = ctx->time_budget || ctx->target_speed;
+	const uint64_t start = timed ? xh_now_ns() : 0;
+	uint64_t chunk_ns = 0; // how long the last chunk took, for both the time budget and the target speed
+	const uint8_t* out_orig = out;
+	const const uint8_t* in_orig = in, *in_end = in+in_len;
+	size_t out_len = *_out_len;
+	if (ctx->target_speed && ctx->speed_level == 0) { ctx->speed_level = ctx->level; }
+	const int level = ctx->target_speed ? ctx->speed_level : ctx->level;
+	ctx->d.MaxChain = xh_levels[level].max_chain;
+	ctx->d.NiceLength = xh_levels[level].nice_length;
+	XpressDictionary_set_adaptive(&ctx->d, ctx->adaptive_chain);
+	ctx->d.Costs = NULL;
+	if (ctx->match_costs)
 	{
-		if (out_len < MIN_DATA) { PRINT_ERROR("Xpress Huffman Compression Error: Insufficient buffer\n"); free(buf); return ENOBUFS; }
-		memset(out, 0, MIN_DATA);
-		out[STREAM_END>>1] = STREAM_END_LEN_1;
-		out += MIN_DATA;
+		memset(ctx->costs, INITIAL_COST, SYMBOLS);
+		ctx->d.LiteralCost = INITIAL_COST << 4;
+		ctx->d.Costs = ctx->costs;
 	}
-	else
+	ctx->chunk = 0;
+	ctx->effort = XH_EFFORT_LEVEL;
+	if (!ctx->dict)
 	{
-		////////// Perform the initial LZ77 compression //////////
-		size_t buf_len = xh_compress_lz77(in, (int32_t)in_len, in_end, buf, symbol_counts, &d);
-
-		////////// Create the Huffman codes/lens and Calculate the compressed output size //////////
-		const uint8_t* lens = CreateCodes(&encoder, symbol_counts);
-		size_t comp_len = xh_calc_compressed_len(lens, symbol_counts, buf_len);
-		
-		////////// Guarantee Max Compression Size //////////
-		// This is required to guarantee max compressed size
-		// It is very rare that it is used (mainly medium-high uncompressible data)
-		if (comp_len > in_len+36) // +36 for alignment and end of stream (because it causes a different symbol to need 9 bits)
+		ctx->window_dict = NULL;
+		XpressDictionary_reset(&ctx->d, in, in_end);
+	}
+
+	// Go through each chunk, the last one includes the end of stream symbol
+	while (in < in_end)
+	{
+		const size_t len = MIN((size_t)(in_end - in), CHUNK_SIZE);
+		const int is_end = in + len == in_end;
+		const uint8_t* chunk = in;
+		if (ctx->time_budget && in != in_orig) { xh_check_budget(ctx, start, chunk_ns, (in_end - in + CHUNK_SIZE - 1) / CHUNK_SIZE); }
+		const uint64_t chunk_start = timed ? xh_now_ns() : 0;
+		if (ctx->dict && in == in_orig) { chunk = xh_ctx_load_dict(ctx, in, len); } // the first chunk is compressed from hist after the preset dictionary
+		else if (ctx->dict && in == in_orig + CHUNK_SIZE) { ctx->window_dict = NULL; xh_ctx_rebase(ctx, in, in_end); }
+		else if ((size_t)(in - ctx->d.start) >= MAX_POS) { xh_ctx_rebase(ctx, in, in_end); }
+
+		// When compressing partially, there has to be room left for an end chunk after a chunk that
+		// does not end the stream
+		const size_t avail = (_in_used && !is_end) ? (out_len > MIN_DATA ? out_len - MIN_DATA : 0) : out_len;
+		const uint32_t in_crc = ctx->in_crc;
+		size_t comp_len;
+		const int err = xh_compress_chunk(ctx, chunk, len, is_end, out, avail, &comp_len, stats);
+		if (err == ENOBUFS && _in_used && in != in_orig)
 		{
-			buf_len = xh_compress_no_matching(in, in_len, 1, buf, symbol_counts);
-			lens = CreateCodesSlow(&encoder, symbol_counts);
-			comp_len = xh_calc_compressed_len_no_matching(lens, symbol_counts);
+			// End the stream before the chunk that did not fit and forget what it counted
+			ctx->in_crc = in_crc;
+			ctx->d.FindCount = ctx->d.ChainSteps = ctx->d.NiceHits = 0;
+			memset(ctx->stage_cycles, 0, sizeof(ctx->stage_cycles));
+			xh_write_end_chunk(ctx, out);
+			out += MIN_DATA;
+			break;
 		}
-
-		////////// Output Huffman prefix codes as lengths and Encode compressed data //////////
-		if (out_len < HALF_SYMBOLS + comp_len) { PRINT_ERROR("Xpress Huffman Compression Error: Insufficient buffer\n"); free(buf); return ENOBUFS; }
-		for (const uint8_t* end = lens + SYMBOLS; lens < end; lens += 2) { *out++ = lens[0] | (lens[1] << 4); }
-		xh_compress_encode(buf, buf+buf_len, out, &encoder);
-		out += comp_len;
+		if (err) { return err; }
+		if (stats && ctx->effort != XH_EFFORT_LEVEL) { ++stats->budget_chunks; }
+		if (timed) { chunk_ns = xh_now_ns() - chunk_start; }
+		if (ctx->target_speed && ctx->effort == XH_EFFORT_LEVEL) { xh_adapt_speed(ctx, len, comp_len, chunk_ns); }
+		in += len;
+		out += comp_len; out_len -= comp_len;
+		++ctx->chunk;
 	}
 
-	// Cleanup
-	free(buf);
-
 	// Return the total number of compressed bytes
 	*_out_len = out - out_orig;
+	if (_in_used) { *_in_used = in - in_orig; }
 	return 0;
 }
 
+int xpress_huff_compress_ctx(xpress_huff_ctx* ctx, const uint8_t* in, size_t in_len, uint8_t* out, size_t* out_len, xpress_huff_stats* stats)
+{
+	return xh_compress(ctx, in, in_len, out, out_len, NULL, stats);
+}
+
+int xpress_huff_compress_partial(xpress_huff_ctx* ctx, const uint8_t* in, size_t in_len, uint8_t* out, size_t* out_len, size_t* in_used, xpress_huff_stats* stats)
+{
+	return xh_compress(ctx, in, in_len, out, out_len, in_used, stats);
+}
+
+int xpress_huff_compress(const uint8_t* in, size_t in_len, uint8_t* out, size_t* out_len)
+{
+	// The context (~14 kb with the Huffman scratch space) is not put on the stack so that this can be
+	// used from threads with small stacks
+	if (in_len == 0) { *out_len = 0; return 0; }
+	xpress_huff_ctx* ctx = xpress_huff_ctx_new();
+	if (ctx == NULL) { return ENOMEM; }
+	const int retval = xpress_huff_compress_ctx(ctx, in, in_len, out, out_len, NULL);
+	xpress_huff_ctx_free(ctx);
+	return retval;
+}
+
+int xpress_huff_compress_with_dict(const uint8_t* dict, size_t dict_len, const uint8_t* in, size_t in_len, uint8_t* out, size_t* out_len)
+{
+	if (in_len == 0) { *out_len = 0; return 0; }
+	xpress_huff_ctx* ctx = xpress_huff_ctx_new();
+	if (ctx == NULL) { return ENOMEM; }
+	int retval = xpress_huff_ctx_set_dict(ctx, dict, dict_len);
+	if (retval == 0) { retval = xpress_huff_compress_ctx(ctx, in, in_len, out, out_len, NULL); }
+	xpress_huff_ctx_free(ctx);
+	return retval;
+}
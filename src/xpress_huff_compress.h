@@ -0,0 +1,233 @@
+// ms-compress: implements Microsoft compression algorithms
+// Copyright (C) 2012  Jeffrey Bush  jeff@coderforlife.com
+// Copyright (C) 2018 David Mulder <dmulder@suse.com>
+//
+// This library is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This library is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+
+////////////////////////////// Xpress Huffman Compression //////////////////////////////////////////
+// The public interface of the Xpress Huffman compressor (MS-XCA 2.1).
+// All functions that return int return 0 on success or an errno value:
+//   ENOMEM   an allocation failed (or the memory limit of the context cannot be met)
+//   EINVAL   an argument is out of range
+//   ENOBUFS  the output buffer is too small (see xpress_huff_max_compressed_size)
+
+#ifndef MSCOMP_XPRESS_HUFF_COMPRESS_H
+#define MSCOMP_XPRESS_HUFF_COMPRESS_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "mscomp_allocator.h"
+
+// Compression levels trade speed for compression ratio: lower levels use a smaller hash table and
+// search fewer and shorter matches. Level 0 is the same as the default.
+#define XPRESS_HUFF_MIN_LEVEL     1
+#define XPRESS_HUFF_MAX_LEVEL     9
+#define XPRESS_HUFF_DEFAULT_LEVEL 5
+
+// A reusable compression context. A context may be used for any number of calls, but only by one
+// thread at a time.
+typedef struct _xpress_huff_ctx xpress_huff_ctx;
+
+// A preset dictionary prepared for compressing with (see xpress_huff_dict_prepare). A prepared
+// dictionary is never modified, so it can be used by any number of contexts in any threads at once.
+typedef struct _xpress_huff_dict xpress_huff_dict;
+
+// The stages of compressing a chunk, for timing
+typedef enum
+{
+	XPRESS_HUFF_STAGE_LZ77,   // finding matches (xh_compress_lz77 or xh_compress_no_matching)
+	XPRESS_HUFF_STAGE_CODES,  // building the Huffman codes (CreateCodes or CreateCodesSlow)
+	XPRESS_HUFF_STAGE_LENGTH, // calculating the compressed length
+	XPRESS_HUFF_STAGE_ENCODE, // writing the Huffman encoded output
+	XPRESS_HUFF_STAGES
+} xpress_huff_stage;
+
+// Called after each stage of each chunk with the number of cycles it took (see
+// xpress_huff_ctx_set_trace). The cycles are TSC ticks on x86, virtual counter ticks on aarch64 and
+// nanoseconds elsewhere.
+typedef void (*xpress_huff_trace_fn)(void* data, uint32_t chunk, xpress_huff_stage stage, uint64_t cycles);
+
+// Statistics about one chunk (64 KiB of input) of a compression
+typedef struct
+{
+	size_t in_len, out_len;     // bytes of input and of output (including the 256 byte Huffman table)
+	uint32_t literals, matches; // symbols written to the chunk
+	uint32_t finds;             // match searches (calls to Find)
+	uint32_t chain_steps;       // hash chain entries examined by all of the searches
+	uint32_t nice_hits;         // searches that stopped early because a match of at least the nice length was found
+	uint8_t fallback;           // 1 if the chunk was stored without matches because they did not pay off
+	uint8_t max_code_len;       // longest Huffman code in the chunk
+	uint64_t cycles[XPRESS_HUFF_STAGES]; // time spent in each stage, 0 unless compiled with MSCOMP_WITH_TIMING
+} xpress_huff_chunk_stats;
+
+// Statistics about a whole compression. Everything is reset at the start of each call except for
+// chunk_stats and chunk_stats_cap: if chunk_stats is not NULL, the stats of the first chunk_stats_cap
+// chunks are written to it (chunks always gives the total number of chunks).
+typedef struct
+{
+	uint64_t in_len, out_len, literals, matches, finds, chain_steps, nice_hits;
+	uint64_t match_len_hist[16];   // match length - 3, the last bucket holds all lengths >= 18
+	uint64_t offset_bits_hist[16]; // highest set bit of the offset (the upper nibble of the match symbol)
+	uint32_t chunks, fallback_chunks;
+	uint32_t budget_chunks;        // chunks compressed with less effort to stay within the time budget
+	uint8_t max_code_len;
+	uint64_t cycles[XPRESS_HUFF_STAGES];
+	xpress_huff_chunk_stats* chunk_stats;
+	size_t chunk_stats_cap;
+} xpress_huff_stats;
+
+// The largest output xpress_huff_compress can produce for in_len bytes of input
+size_t xpress_huff_max_compressed_size(size_t in_len);
+
+// The output is a series of chunks that each hold XPRESS_HUFF_CHUNK_SIZE bytes of the input (the
+// last one the rest). A raw stream does not record the size of the input, but when it is known from
+// elsewhere this is the number of chunks and chunk i decompresses to the bytes starting at
+// i * XPRESS_HUFF_CHUNK_SIZE. Where each chunk starts in the compressed data can only be found by
+// decoding the chunks before it (see xpress_huff_frame.h for a format that records it).
+#define XPRESS_HUFF_CHUNK_SIZE 0x10000
+uint64_t xpress_huff_chunk_count(uint64_t size);
+
+// Compresses in into out. On input *out_len is the size of out, on success it is set to the number
+// of bytes written.
+int xpress_huff_compress(const uint8_t* in, size_t in_len, uint8_t* out, size_t* out_len);
+
+// Creates and frees a context. Returns NULL if out of memory.
+xpress_huff_ctx* xpress_huff_ctx_new(void);
+// Creates a context that makes all of its allocations, including the context itself, with allocator
+// (which is copied). The allocator may be called from whichever thread is using the context.
+xpress_huff_ctx* xpress_huff_ctx_new_with_allocator(const mscomp_allocator* allocator);
+void xpress_huff_ctx_free(xpress_huff_ctx* ctx);
+
+// Sets the compression level of the context (XPRESS_HUFF_MIN_LEVEL to XPRESS_HUFF_MAX_LEVEL, or 0 for
+// the default). Returns EINVAL for any other level.
+int xpress_huff_ctx_set_level(xpress_huff_ctx* ctx, int level);
+
+// Enables (1) or disables (0, the default) the adaptive chain depth: instead of always looking at the
+// level's number of earlier positions for each match, the match search looks at fewer after a run of
+// positions without a match or after a long match and at more (up to 4 times as many) while the
+// matches keep getting better further back. This gets most of the ratio of a deeper search with far
+// fewer positions looked at (chain_steps in the stats).
+void xpress_huff_ctx_set_adaptive_chain(xpress_huff_ctx* ctx, int enable);
+
+// Enables (1) or disables (0, the default) picking matches by their cost: instead of the longest match
+// the match search takes the one that saves the most bits over literals, estimated with the Huffman
+// code lengths of the previous chunk, so a match that is slightly longer but much further away (and
+// so has more offset bits) loses to a closer one. Matches that would cost more than their literals
+// are not used at all. This helps data with many matches of nearly the same length.
+void xpress_huff_ctx_set_match_costs(xpress_huff_ctx* ctx, int enable);
+
+// Limits the memory a compression with the context allocates to limit bytes, including the context
+// itself (0, the default, is no limit). When the level's hash table would not fit a smaller one is
+// used, which lowers the compression ratio. If even the smallest one does not fit the compression
+// fails with ENOMEM. The context also frees buffers kept from larger inputs when they would not fit.
+void xpress_huff_ctx_set_memory_limit(xpress_huff_ctx* ctx, size_t limit);
+
+// The peak number of bytes allocated by threads concurrent compressions of in_len bytes each with the
+// given level, each with a new context: the dictionary, the LZ77 buffer and the context. A context
+// that is reused keeps the largest buffers it has needed so far.
+size_t xpress_huff_memory_usage(int level, unsigned threads, size_t in_len);
+
+// The most of threads concurrent compressions of in_len bytes each that fit in limit bytes when the
+// contexts share the limit (each setting a memory limit of limit / threads), or 0 if not even one fits
+unsigned xpress_huff_threads_for_memory(unsigned threads, size_t in_len, size_t limit);
+
+// Sets a preset dictionary for the context: data that is treated as if it came right before the
+// input of each compression, so that matches in the first 64 KiB of the input can refer to it. This
+// greatly helps small messages that have a lot in common with each other. Only the last 64 KiB of the
+// dictionary is used. The dictionary is copied and hashed once, using the hash table size of the
+// current level, so each compression only copies the prepared tables. The output is standard Xpress
+// Huffman, but decompressing it requires the same dictionary as the history before the output.
+// A NULL dictionary or a dict_len of 0 removes the dictionary. Returns ENOMEM if out of memory.
+int xpress_huff_ctx_set_dict(xpress_huff_ctx* ctx, const uint8_t* dict, size_t dict_len);
+
+// Enables (1) or disables (0, the default) putting the dictionary and the LZ77 buffer in a 2 MiB
+// aligned block backed by transparent huge pages (madvise MADV_HUGEPAGE on Linux), which avoids most
+// of the dTLB misses of the random accesses to the dictionary. The block is a whole number of 2 MiB
+// pages, so it can use more memory than xpress_huff_memory_usage reports. If it cannot be allocated
+// the normal allocations are used. It has no effect on a context with its own allocator.
+void xpress_huff_ctx_set_huge_pages(xpress_huff_ctx* ctx, int enable);
+
+// Limits the time each compression with the context takes to about ns nanoseconds (0, the default,
+// is no limit). The time is checked between chunks (of XPRESS_HUFF_CHUNK_SIZE bytes): when the rest
+// of the chunks would not finish in time at the speed of the last one, the rest get the match search
+// of the fastest level, and if that is still too slow no match search at all (only Huffman coding
+// the literals). The output is always valid, just larger. A chunk is never interrupted, so a
+// compression can still go over by the time of one chunk.
+void xpress_huff_ctx_set_time_budget(xpress_huff_ctx* ctx, uint64_t ns);
+
+// Makes compressions with the context hold about mb_per_sec MB/s (10^6 bytes per second, 0, the
+// default, turns it off) while compressing as well as that allows. After each chunk the match search
+// (the chain depth and nice length) moves one level down when the chunk was slower than the target or
+// did not compress, and one level up when there is room for it, anywhere from the fastest to the
+// best level. The hash table keeps the size of the context's level. What was learned carries over to
+// the next compression with the context, so a long stream can be compressed in pieces. With a time
+// budget as well, the budget wins once it has to lower the effort.
+void xpress_huff_ctx_set_target_speed(xpress_huff_ctx* ctx, uint32_t mb_per_sec);
+
+// Checksums a context can compute while compressing, each chunk is checksummed right after it was
+// read or written, while it is still in the cache, instead of in another pass over memory
+#define XPRESS_HUFF_CHECKSUM_INPUT  1 // the CRC32C of the uncompressed input
+#define XPRESS_HUFF_CHECKSUM_OUTPUT 2 // the CRC32C of the compressed output
+
+// Sets which checksums the context computes (XPRESS_HUFF_CHECKSUM_* flags, 0 for none, the default)
+// and gets them for the last compression. Checksums that were not computed are 0.
+void xpress_huff_ctx_set_checksums(xpress_huff_ctx* ctx, unsigned checksums);
+void xpress_huff_ctx_get_checksums(const xpress_huff_ctx* ctx, uint32_t* in_crc, uint32_t* out_crc);
+
+// The CRC32C the checksums are computed with, for checking them: start with crc 0 and pass the
+// previous result to continue over further data (like zlib's crc32)
+uint32_t xpress_huff_crc32c(uint32_t crc, const uint8_t* data, size_t len);
+
+// Sets the function called with the time taken by each stage of each chunk (NULL to disable). The
+// library only times the stages when compiled with MSCOMP_WITH_TIMING, otherwise this has no effect.
+void xpress_huff_ctx_set_trace(xpress_huff_ctx* ctx, xpress_huff_trace_fn trace, void* data);
+
+// Same as xpress_huff_compress, but keeps the buffers in ctx allocated for the next call.
+// If stats is not NULL it is filled in with statistics about the compression.
+int xpress_huff_compress_ctx(xpress_huff_ctx* ctx, const uint8_t* in, size_t in_len, uint8_t* out, size_t* out_len, xpress_huff_stats* stats);
+
+// Compresses as much of in as fits in out, for filling fixed size buffers: whole chunks (of
+// XPRESS_HUFF_CHUNK_SIZE bytes) are compressed until the next one would not fit, then the stream is
+// ended with a 260 byte chunk holding just the end of stream symbol. *in_used is set to
+// the number of input bytes compressed, the rest can be compressed into another buffer as a separate
+// stream. The output decompresses to exactly the first *in_used bytes of in. Returns ENOBUFS only if
+// not even the first chunk fits.
+int xpress_huff_compress_partial(xpress_huff_ctx* ctx, const uint8_t* in, size_t in_len, uint8_t* out, size_t* out_len, size_t* in_used, xpress_huff_stats* stats);
+
+// Prepares a preset dictionary (see xpress_huff_ctx_set_dict) for sharing between contexts: the data
+// is copied and hashed once with the hash table size of the given level (0 or any invalid level for
+// the default), and every compression with it only copies the prepared tables. Returns NULL if out of
+// memory or dict_len is 0. It must be freed with xpress_huff_dict_free after the contexts are done.
+xpress_huff_dict* xpress_huff_dict_prepare(const uint8_t* dict, size_t dict_len, int level);
+void xpress_huff_dict_free(xpress_huff_dict* dict);
+
+// Makes the context use a prepared dictionary (NULL for none), like xpress_huff_ctx_set_dict but
+// without copying it, so it has to stay valid while the context uses it. The context only reads it.
+// Any dictionary set with xpress_huff_ctx_set_dict is freed.
+void xpress_huff_ctx_use_dict(xpress_huff_ctx* ctx, const xpress_huff_dict* dict);
+
+// Builds a preset dictionary from n_samples sample messages, which are concatenated in samples with
+// the length of each in sample_lens. The dictionary is made of the parts of the samples that have the
+// most in common with the other samples, with the most useful part last (where matches have the
+// smallest offsets). On input *dict_len is the size of dict, on success it is set to the length of
+// the dictionary (at most 64 KiB - 1). Returns EINVAL if there is less than 64 bytes of samples.
+// This is in xpress_huff_train.c.
+int xpress_huff_train_dict(const uint8_t* samples, const size_t* sample_lens, size_t n_samples, uint8_t* dict, size_t* dict_len);
+
+// Same as xpress_huff_compress with a preset dictionary (see xpress_huff_ctx_set_dict). This hashes
+// the dictionary every call, use a context to compress many messages with the same dictionary.
+int xpress_huff_compress_with_dict(const uint8_t* dict, size_t dict_len, const uint8_t* in, size_t in_len, uint8_t* out, size_t* out_len);
+
+#endif
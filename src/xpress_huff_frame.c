@@ -0,0 +1,202 @@
+// ms-compress: implements Microsoft compression algorithms
+// Copyright (C) 2018 David Mulder <dmulder@suse.com>
+//
+// This library is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This library is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+
+#include <errno.h>
+#include <string.h>
+#include "xpress_huff_frame.h"
+#include "xpress_huff_compress.h"
+#include "mscomp_endian.h"
+
+#define MIN(a, b) (((a) < (b)) ? (a) : (b))
+
+////////////////////////////// General Definitions and Functions ///////////////////////////////////
+#define FRAME_VERSION		1
+#define FRAME_BLOCK_UNIT	XPRESS_HUFF_CHUNK_SIZE // block sizes are a multiple of the chunk size
+#define FRAME_INDEX_ENTRY	24
+#define FRAME_FOOTER_SIZE	16
+
+static const uint8_t xf_magic[4] = { 'X', 'H', 'F', '1' }, xf_index_magic[4] = { 'X', 'H', 'F', 'I' };
+
+static void xf_set_uint64(uint8_t* p, uint64_t x) { SET_UINT32(p, (uint32_t)x); SET_UINT32(p + 4, (uint32_t)(x >> 32)); }
+static uint64_t xf_get_uint64(const uint8_t* p) { return (uint64_t)GET_UINT32(p) | ((uint64_t)GET_UINT32(p + 4) << 32); }
+
+// The number of blocks of len bytes, without rounding up by adding block_size - 1 which can wrap
+static uint64_t xf_blocks(uint64_t len, uint64_t block_size) { return len / block_size + (len % block_size != 0); }
+
+size_t xpress_huff_frame_max_size(size_t in_len, size_t block_size)
+{
+	if (block_size == 0) { block_size = XPRESS_HUFF_FRAME_DEFAULT_BLOCK_SIZE; }
+	const size_t blocks = (size_t)xf_blocks(in_len, block_size);
+	// Blocks that do not compress are stored, so no block is larger than its input
+	return XPRESS_HUFF_FRAME_HEADER_SIZE + in_len + blocks * FRAME_INDEX_ENTRY + FRAME_FOOTER_SIZE;
+}
+
+////////////////////////////// Compression Functions ///////////////////////////////////////////////
+int xpress_huff_frame_compress(int level, size_t block_size, const uint8_t* in, size_t in_len, uint8_t* out, size_t* out_len)
+{
+	if (block_size == 0) { block_size = XPRESS_HUFF_FRAME_DEFAULT_BLOCK_SIZE; }
+	if (level == 0) { level = XPRESS_HUFF_DEFAULT_LEVEL; }
+	if (block_size % FRAME_BLOCK_UNIT || block_size > UINT32_MAX - FRAME_BLOCK_UNIT + 1 || level < XPRESS_HUFF_MIN_LEVEL || level > XPRESS_HUFF_MAX_LEVEL) { return EINVAL; }
+	const uint64_t blocks = xf_blocks(in_len, block_size);
+	if (blocks > UINT32_MAX) { return EINVAL; }
+	const size_t index_len = (size_t)blocks * FRAME_INDEX_ENTRY;
+	if (*out_len < XPRESS_HUFF_FRAME_HEADER_SIZE + index_len + FRAME_FOOTER_SIZE) { return ENOBUFS; }
+
+	xpress_huff_ctx* ctx = xpress_huff_ctx_new();
+	if (ctx == NULL) { return ENOMEM; }
+	xpress_huff_ctx_set_level(ctx, level);
+	xpress_huff_ctx_set_checksums(ctx, XPRESS_HUFF_CHECKSUM_INPUT | XPRESS_HUFF_CHECKSUM_OUTPUT);
+
+	////////// Header //////////
+	uint8_t* const frame = out;
+	memcpy(out, xf_magic, 4);
+	out[4] = FRAME_VERSION;
+	out[5] = (uint8_t)level;
+	SET_UINT16(out + 6, 0);
+	SET_UINT32(out + 8, (uint32_t)block_size);
+	SET_UINT32(out + 12, (uint32_t)blocks);
+	xf_set_uint64(out + 16, in_len);
+	SET_UINT32(out + 24, 0);
+	SET_UINT32(out + 28, xpress_huff_crc32c(0, out, 28));
+	out += XPRESS_HUFF_FRAME_HEADER_SIZE;
+
+	////////// Blocks //////////
+	// The index goes after the blocks, so until their size is known it is written at the end of out
+	uint8_t* const out_end = frame + *out_len - index_len - FRAME_FOOTER_SIZE;
+	int err = 0;
+	for (size_t i = 0; i < blocks; ++i)
+	{
+		const uint8_t* block = in + i * block_size;
+		const size_t len = MIN(block_size, in_len - i * block_size);
+		size_t comp_len = out_end - out;
+		uint32_t orig_crc, comp_crc;
+		err = xpress_huff_compress_ctx(ctx, block, len, out, &comp_len, NULL);
+		xpress_huff_ctx_get_checksums(ctx, &orig_crc, &comp_crc);
+		if (err == ENOBUFS || (err == 0 && comp_len >= len))
+		{
+			// Store the block as is
+			if ((size_t)(out_end - out) < len) { err = ENOBUFS; break; }
+			memcpy(out, block, len);
+			comp_len = len;
+			comp_crc = orig_crc = xpress_huff_crc32c(0, block, len); // a compression that ran out of space did not finish the CRC
+			err = 0;
+		}
+		if (err) { break; }
+
+		uint8_t* entry = out_end + i * FRAME_INDEX_ENTRY;
+		xf_set_uint64(entry, out - frame);
+		SET_UINT32(entry + 8, (uint32_t)comp_len);
+		SET_UINT32(entry + 12, (uint32_t)len);
+		SET_UINT32(entry + 16, orig_crc);
+		SET_UINT32(entry + 20, comp_crc);
+		out += comp_len;
+	}
+	xpress_huff_ctx_free(ctx);
+	if (err) { return err; }
+
+	////////// Index and footer //////////
+	memmove(out, out_end, index_len);
+	const uint32_t index_crc = xpress_huff_crc32c(0, out, index_len);
+	xf_set_uint64(out + index_len, out - frame);
+	SET_UINT32(out + index_len + 8, index_crc);
+	memcpy(out + index_len + 12, xf_index_magic, 4);
+	*out_len = out + index_len + FRAME_FOOTER_SIZE - frame;
+	return 0;
+}
+
+////////////////////////////// Reading Functions ///////////////////////////////////////////////////
+int xpress_huff_frame_read_header(const uint8_t* frame, size_t len, xpress_huff_frame_info* info)
+{
+	if (len < XPRESS_HUFF_FRAME_HEADER_SIZE || memcmp(frame, xf_magic, 4) != 0 || frame[4] != FRAME_VERSION ||
+		(uint32_t)GET_UINT32(frame + 28) != xpress_huff_crc32c(0, frame, 28)) { return EINVAL; }
+	info->level = frame[5];
+	info->block_size = GET_UINT32(frame + 8);
+	info->blocks = GET_UINT32(frame + 12);
+	info->size = xf_get_uint64(frame + 16);
+	if (info->block_size == 0 || info->block_size % FRAME_BLOCK_UNIT || xf_blocks(info->size, info->block_size) != info->blocks) { return EINVAL; }
+	info->chunks = xpress_huff_chunk_count(info->size);
+	info->tail_len = (size_t)info->blocks * FRAME_INDEX_ENTRY + FRAME_FOOTER_SIZE;
+	return 0;
+}
+
+// Fills in a block from its index entry, the payload is at frame + block->frame_offset
+static void xf_read_entry(const xpress_huff_frame_info* info, const uint8_t* entry, uint32_t i, xpress_huff_frame_block* block)
+{
+	block->data = NULL;
+	block->frame_offset = xf_get_uint64(entry);
+	block->comp_len = GET_UINT32(entry + 8);
+	block->orig_len = GET_UINT32(entry + 12);
+	block->offset = (uint64_t)i * info->block_size;
+	block->orig_crc = GET_UINT32(entry + 16);
+	block->comp_crc = GET_UINT32(entry + 20);
+	block->stored = block->comp_len == block->orig_len;
+}
+
+// Checks the footer and index at the end of a frame of frame_len bytes (tail is the last
+// info->tail_len bytes): that the blocks are in order, fit before the index and add up to the
+// original size
+static int xf_check_tail(const xpress_huff_frame_info* info, const uint8_t* tail, uint64_t frame_len)
+{
+	const size_t index_len = info->tail_len - FRAME_FOOTER_SIZE;
+	const uint8_t* footer = tail + index_len;
+	const uint64_t index_offset = xf_get_uint64(footer);
+	if (frame_len < XPRESS_HUFF_FRAME_HEADER_SIZE + info->tail_len || memcmp(footer + 12, xf_index_magic, 4) != 0 ||
+		index_offset != frame_len - info->tail_len || (uint32_t)GET_UINT32(footer + 8) != xpress_huff_crc32c(0, tail, index_len)) { return EINVAL; }
+	uint64_t end = XPRESS_HUFF_FRAME_HEADER_SIZE, size = 0;
+	for (uint32_t i = 0; i < info->blocks; ++i, tail += FRAME_INDEX_ENTRY)
+	{
+		xpress_huff_frame_block b;
+		xf_read_entry(info, tail, i, &b);
+		if (b.frame_offset != end || b.comp_len > b.orig_len || b.orig_len != MIN(info->block_size, info->size - size)) { return EINVAL; }
+		end += b.comp_len;
+		size += b.orig_len;
+	}
+	return end == index_offset ? 0 : EINVAL;
+}
+
+int xpress_huff_frame_read_index(const xpress_huff_frame_info* info, const uint8_t* tail, size_t tail_len, uint64_t frame_len, xpress_huff_frame_block* blocks)
+{
+	if (tail_len < info->tail_len) { return EINVAL; }
+	tail += tail_len - info->tail_len;
+	const int err = xf_check_tail(info, tail, frame_len);
+	if (err) { return err; }
+	for (uint32_t i = 0; i < info->blocks; ++i) { xf_read_entry(info, tail + (size_t)i * FRAME_INDEX_ENTRY, i, &blocks[i]); }
+	return 0;
+}
+
+int xpress_huff_frame_open(const uint8_t* frame, size_t len, xpress_huff_frame* f)
+{
+	int err = xpress_huff_frame_read_header(frame, len, &f->info);
+	if (err) { return err; }
+	if (len < f->info.tail_len || (err = xf_check_tail(&f->info, frame + len - f->info.tail_len, len)) != 0) { return err ? err : EINVAL; }
+	f->data = frame;
+	f->index = frame + len - f->info.tail_len;
+	return 0;
+}
+
+int xpress_huff_frame_get_block(const xpress_huff_frame* f, uint32_t i, xpress_huff_frame_block* block)
+{
+	if (i >= f->info.blocks) { return EINVAL; }
+	xf_read_entry(&f->info, f->index + (size_t)i * FRAME_INDEX_ENTRY, i, block);
+	block->data = f->data + block->frame_offset;
+	return 0;
+}
+
+int xpress_huff_frame_verify_block(const xpress_huff_frame_block* block)
+{
+	return xpress_huff_crc32c(0, block->data, block->comp_len) == block->comp_crc ? 0 : EINVAL;
+}
@@ -0,0 +1,110 @@
+// ms-compress: implements Microsoft compression algorithms
+// Copyright (C) 2018 David Mulder <dmulder@suse.com>
+//
+// This library is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This library is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+
+////////////////////////////// Framed Xpress Huffman ///////////////////////////////////////////////
+// An optional container for stored data that, unlike a raw MS-XCA stream, tells the original size,
+// can be checked for corruption and can be split into blocks that are decompressed independently
+// (for example in parallel or for random access). The input is split into blocks of block_size
+// bytes, each compressed on its own into an unmodified Xpress Huffman stream.
+//
+// The format (all integers little-endian):
+//   header (32 bytes):  "XHF1", version (1 byte, 1), level (1 byte), 2 reserved bytes, block_size
+//                       (uint32), blocks (uint32), original size (uint64), 4 reserved bytes and the
+//                       CRC32C of the previous 28 bytes (uint32)
+//   blocks:             the payload of each block: the Xpress Huffman stream or, when that would not
+//                       be smaller, the block as is
+//   index (24 bytes per block): offset of the payload in the frame (uint64), payload size (uint32),
+//                       original size (uint32), CRC32C of the original data and of the payload (uint32s)
+//                       A block is stored as is when its payload size equals its original size.
+//   footer (16 bytes):  offset of the index (uint64), CRC32C of the index (uint32), "XHFI"
+// The CRC32Cs are the ones from xpress_huff_crc32c.
+//
+// All functions that return int return 0 on success or an errno value:
+//   ENOMEM   an allocation failed
+//   EINVAL   an argument is out of range or the frame is not valid
+//   ENOBUFS  the output buffer is too small (see xpress_huff_frame_max_size)
+
+#ifndef MSCOMP_XPRESS_HUFF_FRAME_H
+#define MSCOMP_XPRESS_HUFF_FRAME_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define XPRESS_HUFF_FRAME_HEADER_SIZE        32
+#define XPRESS_HUFF_FRAME_DEFAULT_BLOCK_SIZE 0x100000 // 1 MiB
+
+// What the header of a frame tells
+typedef struct
+{
+	uint64_t size;       // of the original data
+	uint32_t block_size; // of the original data in each block except the last
+	uint32_t blocks;
+	int level;
+	uint64_t chunks;     // the number of Xpress Huffman chunks in all of the blocks
+	size_t tail_len;     // the size of the index and footer at the end of the frame
+} xpress_huff_frame_info;
+
+// An opened frame (see xpress_huff_frame_open), it points into the frame data
+typedef struct
+{
+	xpress_huff_frame_info info;
+	const uint8_t* data;
+	const uint8_t* index;
+} xpress_huff_frame;
+
+typedef struct
+{
+	const uint8_t* data;      // the payload (NULL from xpress_huff_frame_read_index)
+	uint64_t frame_offset;    // of the payload in the frame
+	uint32_t comp_len;        // the size of the payload
+	uint32_t orig_len;        // the size of the original data
+	uint64_t offset;          // of the original data in the whole
+	uint32_t orig_crc, comp_crc;
+	int stored;               // the payload is the original data as is instead of Xpress Huffman
+} xpress_huff_frame_block;
+
+// The largest frame xpress_huff_frame_compress can produce for in_len bytes of input
+size_t xpress_huff_frame_max_size(size_t in_len, size_t block_size);
+
+// Compresses in into a frame in out at the given level (0 for the default) with blocks of block_size
+// bytes (a multiple of 64 KiB, 0 for XPRESS_HUFF_FRAME_DEFAULT_BLOCK_SIZE). Smaller blocks allow more
+// parallelism and cheaper random access but compress worse since matches cannot cross blocks. On
+// input *out_len is the size of out, on success it is set to the number of bytes written.
+int xpress_huff_frame_compress(int level, size_t block_size, const uint8_t* in, size_t in_len, uint8_t* out, size_t* out_len);
+
+// Reads the header of a frame, only the first XPRESS_HUFF_FRAME_HEADER_SIZE bytes are needed. This
+// gives the exact decompressed size, so the output buffer can be allocated before anything else is
+// read.
+int xpress_huff_frame_read_header(const uint8_t* frame, size_t len, xpress_huff_frame_info* info);
+
+// Reads the index of a frame of frame_len bytes without the blocks: tail holds (at least) the last
+// info->tail_len bytes of the frame. Fills blocks (info->blocks entries) with where each block's
+// payload is in the frame and where its data goes in the original, for example to fetch and
+// decompress only some blocks of a frame in an object store.
+int xpress_huff_frame_read_index(const xpress_huff_frame_info* info, const uint8_t* tail, size_t tail_len, uint64_t frame_len, xpress_huff_frame_block* blocks);
+
+// Checks the header, index and footer of a whole frame and sets up f for getting its blocks
+int xpress_huff_frame_open(const uint8_t* frame, size_t len, xpress_huff_frame* f);
+
+// Gets block i of an opened frame
+int xpress_huff_frame_get_block(const xpress_huff_frame* f, uint32_t i, xpress_huff_frame_block* block);
+
+// Checks the payload of a block against its checksum, returns EINVAL if it is corrupt. The CRC32C of
+// the decompressed data can be checked against block->orig_crc.
+int xpress_huff_frame_verify_block(const xpress_huff_frame_block* block);
+
+#endif
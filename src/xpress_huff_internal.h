@@ -0,0 +1,45 @@
+// ms-compress: implements Microsoft compression algorithms
+// Copyright (C) 2018 David Mulder <dmulder@suse.com>
+//
+// This library is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This library is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+
+////////////////////////////// Xpress Huffman Stages ////////////////////////////////////////////
+// The stages of a chunk's compression in xpress_huff_compress.c, declared here so that they can be
+// timed on their own (see bench/microbench.c). They are not part of the API.
+
+#ifndef MSCOMP_XPRESS_HUFF_INTERNAL_H
+#define MSCOMP_XPRESS_HUFF_INTERNAL_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "XpressDictionary.h"
+#include "HuffmanEncoder.h"
+
+#define STREAM_END		0x100
+
+// LZ77 compresses in_len bytes of in into the intermediate format in out and counts the symbols,
+// returns the length of out
+size_t xh_compress_lz77(const uint8_t* in, int32_t in_len, int is_end, uint8_t* out, uint32_t symbol_counts[SYMBOLS], XpressDictionary* d);
+
+// Like xh_compress_lz77 but without looking for matches
+size_t xh_compress_no_matching(const uint8_t* in, size_t in_len, int is_end, uint8_t* out, uint32_t symbol_counts[SYMBOLS]);
+
+// The length of the bitstream of the intermediate data in buf_len bytes with the codes of lens
+size_t xh_calc_compressed_len(const uint8_t lens[SYMBOLS], const uint32_t symbol_counts[SYMBOLS], const size_t buf_len);
+
+// Writes the Huffman coded bitstream of the intermediate data from in to in_end to out
+void xh_compress_encode(const uint8_t* in, const uint8_t* in_end, uint8_t* out, HuffmanEncoder *encoder);
+
+#endif
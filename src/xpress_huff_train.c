@@ -0,0 +1,135 @@
+// ms-compress: implements Microsoft compression algorithms
+// Copyright (C) 2018 David Mulder <dmulder@suse.com>
+//
+// This library is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This library is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+
+////////////////////////////// Dictionary Training /////////////////////////////////////////////////
+// Builds a preset dictionary (see xpress_huff_ctx_set_dict) from sample messages by picking the
+// segments of the samples that contain the most substrings shared by many samples.
+//
+// Each TRAIN_DMER_LEN byte substring is counted once per sample it appears in, so that data repeated
+// within a single sample (which the sample can match on its own) does not count. The samples are
+// split into one epoch per segment that fits in the dictionary and the TRAIN_SEGMENT_LEN bytes of each
+// epoch with the highest total count are picked. The substrings of a picked segment are not counted
+// again for later segments. The segments are then ordered by their score with the best one last,
+// since the end of the dictionary is right before the input: those matches have the lowest offsets,
+// which need the fewest offset bits.
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include "xpress_huff_compress.h"
+
+#define TRAIN_DMER_LEN		8
+#define TRAIN_SEGMENT_LEN	64
+#define TRAIN_HASH_BITS		20
+#define TRAIN_MAX_DICT		0xFFFF // only the last MAX_OFFSET bytes of a dictionary are used
+
+typedef struct
+{
+	size_t pos;     // in the concatenated samples
+	uint64_t score;
+} xh_train_segment;
+
+static uint32_t xh_train_hash(const uint8_t* x)
+{
+	uint64_t v;
+	memcpy(&v, x, sizeof(v));
+	return (uint32_t)((v * 0x9E3779B97F4A7C15ull) >> (64 - TRAIN_HASH_BITS));
+}
+
+static int xh_train_segment_cmp(const void* a, const void* b)
+{
+	const uint64_t x = ((const xh_train_segment*)a)->score, y = ((const xh_train_segment*)b)->score;
+	return (x > y) - (x < y);
+}
+
+// Sums the counts of the substrings starting in the segment at pos
+static uint64_t xh_train_score(const uint32_t* hashes, const uint32_t* counts, size_t pos)
+{
+	uint64_t score = 0;
+	for (size_t i = pos, end = pos + TRAIN_SEGMENT_LEN - TRAIN_DMER_LEN + 1; i < end; ++i) { score += counts[hashes[i]]; }
+	return score;
+}
+
+// Trains a dictionary of up to n_segments segments with the working memory given, returns its length
+static size_t xh_train(const uint8_t* samples, const size_t* sample_lens, size_t n_samples, size_t total, size_t n_segments,
+	uint32_t* counts, uint32_t* last, uint32_t* hashes, xh_train_segment* segments, uint8_t* dict)
+{
+	////////// Count the substrings in the samples //////////
+	// Substrings that span two samples are hashed (so segments can be scored anywhere) but not counted
+	size_t pos = 0;
+	for (size_t s = 0; s < n_samples; ++s)
+	{
+		const size_t end = pos + sample_lens[s];
+		for (; pos < end && pos + TRAIN_DMER_LEN <= total; ++pos)
+		{
+			const uint32_t h = hashes[pos] = xh_train_hash(samples + pos);
+			if (pos + TRAIN_DMER_LEN <= end && last[h] != s + 1) { last[h] = (uint32_t)(s + 1); ++counts[h]; }
+		}
+		pos = end;
+	}
+
+	////////// Pick the best segment of each epoch //////////
+	const size_t last_start = total - TRAIN_SEGMENT_LEN;
+	size_t epoch_len = total / n_segments, n = 0;
+	if (epoch_len < TRAIN_SEGMENT_LEN) { epoch_len = TRAIN_SEGMENT_LEN; }
+	for (size_t epoch = 0; epoch <= last_start && n < n_segments; epoch += epoch_len)
+	{
+		const size_t epoch_end = (epoch + epoch_len - 1 < last_start) ? epoch + epoch_len - 1 : last_start;
+		xh_train_segment best = { epoch, 0 };
+		uint64_t score = xh_train_score(hashes, counts, epoch);
+		for (size_t i = epoch; ; )
+		{
+			if (score > best.score) { best.pos = i; best.score = score; }
+			if (i++ == epoch_end) { break; }
+			score += counts[hashes[i + TRAIN_SEGMENT_LEN - TRAIN_DMER_LEN]];
+			score -= counts[hashes[i - 1]];
+		}
+		if (best.score == 0) { continue; }
+
+		// Counting a substring once is enough
+		for (size_t i = best.pos, end = best.pos + TRAIN_SEGMENT_LEN - TRAIN_DMER_LEN + 1; i < end; ++i) { counts[hashes[i]] = 0; }
+		segments[n++] = best;
+	}
+
+	////////// Put the best segments last //////////
+	qsort(segments, n, sizeof(xh_train_segment), xh_train_segment_cmp);
+	for (size_t i = 0; i < n; ++i) { memcpy(dict + i * TRAIN_SEGMENT_LEN, samples + segments[i].pos, TRAIN_SEGMENT_LEN); }
+	return n * TRAIN_SEGMENT_LEN;
+}
+
+int xpress_huff_train_dict(const uint8_t* samples, const size_t* sample_lens, size_t n_samples, uint8_t* dict, size_t* dict_len)
+{
+	size_t total = 0;
+	for (size_t i = 0; i < n_samples; ++i) { total += sample_lens[i]; }
+	const size_t cap = *dict_len < TRAIN_MAX_DICT ? *dict_len : TRAIN_MAX_DICT;
+	*dict_len = 0;
+	if (n_samples == 0 || total < TRAIN_SEGMENT_LEN) { return EINVAL; }
+	if (cap < TRAIN_SEGMENT_LEN) { return 0; }
+
+	const size_t n_segments = cap / TRAIN_SEGMENT_LEN;
+	uint32_t* counts = (uint32_t*)calloc((size_t)1 << TRAIN_HASH_BITS, sizeof(uint32_t));
+	uint32_t* last = (uint32_t*)calloc((size_t)1 << TRAIN_HASH_BITS, sizeof(uint32_t)); // 1 + the last sample each substring was counted in
+	uint32_t* hashes = (uint32_t*)malloc((total - TRAIN_DMER_LEN + 1) * sizeof(uint32_t));
+	xh_train_segment* segments = (xh_train_segment*)malloc(n_segments * sizeof(xh_train_segment));
+	const int err = (counts && last && hashes && segments) ? 0 : ENOMEM;
+	if (!err) { *dict_len = xh_train(samples, sample_lens, n_samples, total, n_segments, counts, last, hashes, segments, dict); }
+	free(counts);
+	free(last);
+	free(hashes);
+	free(segments);
+	return err;
+}
@@ -0,0 +1,125 @@
+// ms-compress: implements Microsoft compression algorithms
+// Copyright (C) 2018 David Mulder <dmulder@suse.com>
+//
+// This library is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This library is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+
+////////////////////////////// Automatic Algorithm Selection Test //////////////////////////////////
+// Compresses every corpus with xpress_auto_compress under every set of allowed algorithms and checks
+// that the algorithm used is allowed and that the output decompresses with it, that incompressible
+// input is stored as is, and that an algorithm that fits the budget keeps being used after slow runs.
+
+#include "test.h"
+#include "xpress_decode.h"
+#include "xpress_huff_decode.h"
+#include "../src/xpress_auto_compress.h"
+#include "../src/lznt1.h"
+
+// Decompresses out with the algorithm it was compressed with and checks that it gives in
+static int test_decompress(xpress_auto_algorithm algorithm, const uint8_t* out, size_t out_len, const uint8_t* in, size_t len)
+{
+	uint8_t* dec = (uint8_t*)malloc(len ? len : 1);
+	size_t dec_len = len;
+	int ok = 0;
+	if (dec == NULL) { return 0; }
+	switch (algorithm)
+	{
+	case XPRESS_AUTO_NONE:        ok = out_len == len && memcmp(out, in, len) == 0; break;
+	case XPRESS_AUTO_LZNT1:       ok = lznt1_decompress(out, out_len, dec, &dec_len) == 0 && dec_len == len && memcmp(dec, in, len) == 0; break;
+	case XPRESS_AUTO_XPRESS:      ok = test_xpress_decompress(out, out_len, dec, &dec_len) == 0 && dec_len == len && memcmp(dec, in, len) == 0; break;
+	case XPRESS_AUTO_XPRESS_HUFF: ok = test_xpress_huff_decompress(out, out_len, dec, len) == 0 && memcmp(dec, in, len) == 0; break;
+	default: break;
+	}
+	free(dec);
+	return ok;
+}
+
+// Compresses in (len bytes of the corpus) with only the allowed algorithms (besides no compression) and
+// returns the one used
+static xpress_auto_algorithm test_auto(xpress_auto_ctx* ctx, unsigned allowed, corpus_type type, const uint8_t* in, size_t len)
+{
+	size_t out_len = xpress_auto_max_compressed_size(len);
+	uint8_t* out = (uint8_t*)malloc(out_len);
+	xpress_auto_algorithm algorithm = XPRESS_AUTO_ALGORITHMS;
+	TEST_CHECK(out != NULL, "out of memory");
+	if (out)
+	{
+		xpress_auto_ctx_set_algorithms(ctx, allowed);
+		const int err = xpress_auto_compress(ctx, in, len, out, &out_len, 0, &algorithm);
+		TEST_CHECK(err == 0, "%s of %zu bytes with algorithms %x: error %d", corpus_names[type], len, allowed, err);
+		if (err == 0)
+		{
+			TEST_CHECK((allowed | XPRESS_AUTO_ALLOW(XPRESS_AUTO_NONE)) & XPRESS_AUTO_ALLOW(algorithm), "%s of %zu bytes: algorithm %d is not in %x", corpus_names[type], len, algorithm, allowed);
+			TEST_CHECK(out_len <= len, "%s of %zu bytes grew to %zu bytes", corpus_names[type], len, out_len);
+			TEST_CHECK(test_decompress(algorithm, out, out_len, in, len), "%s of %zu bytes does not decompress with algorithm %d", corpus_names[type], len, algorithm);
+		}
+	}
+	free(out);
+	return algorithm;
+}
+
+int main(void)
+{
+	xpress_auto_ctx* ctx = xpress_auto_ctx_new();
+	TEST_CHECK(ctx != NULL, "out of memory");
+	if (ctx == NULL) { return test_done("auto"); }
+
+	for (int type = 0; type < CORPUS_COUNT; ++type)
+	{
+		for (size_t i = 0; i < TEST_SIZES; i += 3)
+		{
+			uint8_t* in = test_corpus((corpus_type)type, test_sizes[i]);
+			for (unsigned allowed = 0; allowed <= XPRESS_AUTO_ALLOW_ALL; ++allowed) { test_auto(ctx, allowed, (corpus_type)type, in, test_sizes[i]); }
+			free(in);
+		}
+	}
+
+	// Text is always compressed when any algorithm is allowed, random data never is
+	uint8_t* text = test_corpus(CORPUS_TEXT, 65536), * random = test_corpus(CORPUS_RANDOM, 65536);
+	for (unsigned allowed = XPRESS_AUTO_ALLOW(XPRESS_AUTO_LZNT1); allowed <= XPRESS_AUTO_ALLOW_ALL; allowed += XPRESS_AUTO_ALLOW(XPRESS_AUTO_LZNT1))
+	{
+		TEST_CHECK(test_auto(ctx, allowed, CORPUS_TEXT, text, 65536) != XPRESS_AUTO_NONE, "text with algorithms %x was not compressed", allowed);
+		TEST_CHECK(test_auto(ctx, allowed, CORPUS_RANDOM, random, 65536) == XPRESS_AUTO_NONE, "random data with algorithms %x was not stored", allowed);
+	}
+	free(text); free(random);
+
+	// Stored data still needs room for the whole input
+	uint8_t* in = test_corpus(CORPUS_RANDOM, 4096), out[4096];
+	size_t out_len = 4095;
+	xpress_auto_algorithm algorithm;
+	xpress_auto_ctx_set_algorithms(ctx, XPRESS_AUTO_ALLOW_ALL);
+	TEST_CHECK(xpress_auto_compress(ctx, in, 4096, out, &out_len, 0, &algorithm) == ENOBUFS, "4096 bytes of random data were stored in 4095 bytes");
+	free(in);
+
+	// With a budget of 1.5 times the initial estimate of LZNT1 (2000 ns plus 16 ns per byte), runs that
+	// are slower than that must not keep it from being tried again
+	const size_t len = 65536;
+	const uint64_t budget = (uint64_t)(1.5 * (2000 + 16.0 * len));
+	in = test_corpus(CORPUS_TEXT, len);
+	uint8_t* out2 = (uint8_t*)malloc(xpress_auto_max_compressed_size(len));
+	TEST_CHECK(out2 != NULL, "out of memory");
+	unsigned used = 0;
+	xpress_auto_ctx_set_algorithms(ctx, XPRESS_AUTO_ALLOW(XPRESS_AUTO_LZNT1));
+	for (unsigned i = 0; out2 && i < 300; ++i)
+	{
+		out_len = xpress_auto_max_compressed_size(len);
+		TEST_CHECK(xpress_auto_compress(ctx, in, len, out2, &out_len, budget, &algorithm) == 0, "text of %zu bytes within %llu ns failed", len, (unsigned long long)budget);
+		used += algorithm == XPRESS_AUTO_LZNT1;
+	}
+	TEST_CHECK(used >= 2, "LZNT1 was only used %u times in 300 calls", used);
+	free(in); free(out2);
+
+	xpress_auto_ctx_free(ctx);
+	return test_done("auto");
+}
@@ -0,0 +1,113 @@
+// ms-compress: implements Microsoft compression algorithms
+// Copyright (C) 2018 David Mulder <dmulder@suse.com>
+//
+// This library is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This library is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+
+////////////////////////////// Time Budget Test ////////////////////////////////////////////////////
+// Compresses with a time budget that the best level cannot keep and checks that the effort is lowered
+// as soon as the remaining chunks would not finish in time, also when a target speed is set as well
+// (which times the same chunks), and that the output still decompresses, even with a budget of 1 ns.
+
+#include <time.h>
+#include "test.h"
+#include "xpress_huff_decode.h"
+#include "../src/xpress_huff_compress.h"
+
+#define CHUNKS	32
+
+static uint64_t test_now_ns(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000u + (uint64_t)ts.tv_nsec;
+}
+
+// Compresses in with the context and checks that the output decompresses, returning how long it took
+static uint64_t test_budget(xpress_huff_ctx* ctx, const uint8_t* in, size_t len, xpress_huff_stats* stats, const char* what)
+{
+	size_t out_len = xpress_huff_max_compressed_size(len);
+	uint8_t* out = (uint8_t*)malloc(out_len), * dec = (uint8_t*)malloc(len);
+	uint64_t ns = 0;
+	TEST_CHECK(out && dec, "out of memory");
+	if (out && dec)
+	{
+		const uint64_t start = test_now_ns();
+		const int err = xpress_huff_compress_ctx(ctx, in, len, out, &out_len, stats);
+		ns = test_now_ns() - start;
+		TEST_CHECK(err == 0, "%s: error %d", what, err);
+		TEST_CHECK(err || (test_xpress_huff_decompress(out, out_len, dec, len) == 0 && memcmp(in, dec, len) == 0), "%s does not decompress", what);
+	}
+	free(out); free(dec);
+	return ns;
+}
+
+int main(void)
+{
+	const size_t len = CHUNKS * XPRESS_HUFF_CHUNK_SIZE;
+	uint8_t* text = test_corpus(CORPUS_TEXT, len);
+	xpress_huff_chunk_stats chunk_stats[CHUNKS];
+	xpress_huff_stats stats;
+	stats.chunk_stats = chunk_stats;
+	stats.chunk_stats_cap = CHUNKS;
+	xpress_huff_ctx* ctx = xpress_huff_ctx_new();
+	TEST_CHECK(ctx != NULL && xpress_huff_ctx_set_level(ctx, XPRESS_HUFF_MAX_LEVEL) == 0, "out of memory");
+	if (ctx == NULL) { free(text); return test_done("budget"); }
+
+	// How long the best level takes without a budget (the faster of two runs)
+	uint64_t full_ns = test_budget(ctx, text, len, &stats, "text without a budget");
+	const uint64_t ns = test_budget(ctx, text, len, &stats, "text without a budget again");
+	if (ns < full_ns) { full_ns = ns; }
+	TEST_CHECK(stats.budget_chunks == 0, "%u chunks were compressed with less effort without a budget", stats.budget_chunks);
+
+	// Half of that time: after the first chunk the rest would not finish at its speed, so all of them
+	// get the fastest level's match search (which still finds matches). With a target speed the chunks
+	// are timed for both.
+	for (int speed = 0; speed < 2; ++speed)
+	{
+		const char* what = speed ? "text with a budget and a target speed" : "text with a budget";
+		xpress_huff_ctx_set_time_budget(ctx, full_ns / 2);
+		xpress_huff_ctx_set_target_speed(ctx, speed ? 1 : 0);
+		test_budget(ctx, text, len, &stats, what);
+		TEST_CHECK(stats.budget_chunks >= CHUNKS - CHUNKS / 4, "%s: only %u of %u chunks got less effort", what, stats.budget_chunks, CHUNKS);
+		TEST_CHECK(chunk_stats[1].matches > 0, "%s: the second chunk got no match search at all", what);
+	}
+
+	// A budget of 1 ns is always over by the second chunk, which gets no match search, and the rest
+	// too, but the output is still valid. The effort starts over with each compression.
+	xpress_huff_ctx_set_target_speed(ctx, 0);
+	for (int type = 0; type < CORPUS_COUNT; ++type)
+	{
+		for (size_t i = 0; i < TEST_SIZES; i += 2)
+		{
+			uint8_t* in = test_corpus((corpus_type)type, test_sizes[i]);
+			const uint32_t chunks = (uint32_t)xpress_huff_chunk_count(test_sizes[i]);
+			xpress_huff_ctx_set_time_budget(ctx, 1);
+			test_budget(ctx, in, test_sizes[i], &stats, "a budget of 1 ns");
+			TEST_CHECK(stats.budget_chunks == chunks - 1, "%s of %zu bytes with a budget of 1 ns: %u of %u chunks got less effort", corpus_names[type], test_sizes[i], stats.budget_chunks, chunks);
+			for (uint32_t c = 1; c < chunks && c < CHUNKS; ++c)
+			{
+				TEST_CHECK(chunk_stats[c].matches == 0, "%s of %zu bytes with a budget of 1 ns: chunk %u has matches", corpus_names[type], test_sizes[i], c);
+			}
+			xpress_huff_ctx_set_time_budget(ctx, 0);
+			test_budget(ctx, in, test_sizes[i], &stats, "no budget after a budget of 1 ns");
+			TEST_CHECK(stats.budget_chunks == 0, "%s of %zu bytes: %u chunks got less effort after the budget was removed", corpus_names[type], test_sizes[i], stats.budget_chunks);
+			free(in);
+		}
+	}
+
+	xpress_huff_ctx_free(ctx);
+	free(text);
+	return test_done("budget");
+}
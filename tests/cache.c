@@ -0,0 +1,156 @@
+// ms-compress: implements Microsoft compression algorithms
+// Copyright (C) 2018 David Mulder <dmulder@suse.com>
+//
+// This library is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This library is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+
+////////////////////////////// Compression Result Cache Test ///////////////////////////////////////
+// Checks that xpress_huff_cache_compress gives the output of xpress_huff_compress on hits and misses,
+// that only the same input at the same level hits, that the least recently used results are dropped
+// first and that the memory use, lookup table included, never goes over the limit.
+
+#include "test.h"
+#include "xpress_huff_decode.h"
+#include "../src/xpress_huff_cache.h"
+#include "../src/xpress_huff_compress.h"
+
+#define BLOCK	4096
+
+// Compresses in with the cache and checks the output and whether it was a hit
+static void test_cache(xpress_huff_cache* cache, int level, const uint8_t* in, size_t len, int hit, const char* what)
+{
+	xpress_huff_cache_stats before, after;
+	xpress_huff_cache_get_stats(cache, &before);
+	size_t out_len = xpress_huff_max_compressed_size(len), out_len2 = out_len;
+	uint8_t* out = (uint8_t*)malloc(out_len), * out2 = (uint8_t*)malloc(out_len), * dec = (uint8_t*)malloc(len ? len : 1);
+	TEST_CHECK(out && out2 && dec, "out of memory");
+	if (out && out2 && dec)
+	{
+		xpress_huff_ctx* ctx = xpress_huff_ctx_new();
+		int err = ctx ? xpress_huff_ctx_set_level(ctx, level) : ENOMEM;
+		err = err ? err : xpress_huff_compress_ctx(ctx, in, len, out, &out_len, NULL);
+		err = err ? err : xpress_huff_cache_compress(cache, level, in, len, out2, &out_len2);
+		TEST_CHECK(err == 0, "%s: error %d", what, err);
+		TEST_CHECK(err || (out_len2 == out_len && memcmp(out, out2, out_len) == 0), "%s: the cache compressed differently", what);
+		TEST_CHECK(err || len == 0 || (test_xpress_huff_decompress(out2, out_len2, dec, len) == 0 && memcmp(in, dec, len) == 0), "%s does not decompress", what);
+		xpress_huff_ctx_free(ctx);
+	}
+	free(out); free(out2); free(dec);
+	xpress_huff_cache_get_stats(cache, &after);
+	TEST_CHECK(after.hits == before.hits + (hit != 0) && after.misses == before.misses + (hit == 0), "%s: expected a %s", what, hit ? "hit" : "miss");
+}
+
+// Fills a block with the byte b, all such blocks compress to the same size
+static const uint8_t* test_block(uint8_t* block, uint8_t b)
+{
+	memset(block, b, BLOCK);
+	return block;
+}
+
+int main(void)
+{
+	xpress_huff_cache_stats stats;
+	uint8_t block[BLOCK];
+
+	////////// Hits and misses //////////
+	xpress_huff_cache* cache = xpress_huff_cache_new(1 << 24);
+	TEST_CHECK(cache != NULL, "out of memory");
+	if (cache == NULL) { return test_done("cache"); }
+	uint8_t* text = test_corpus(CORPUS_TEXT, 65536), * copy = (uint8_t*)malloc(65536);
+	TEST_CHECK(copy != NULL, "out of memory");
+	if (copy)
+	{
+		memcpy(copy, text, 65536);
+		test_cache(cache, 0, text, 65536, 0, "text");
+		test_cache(cache, 0, text, 65536, 1, "text again");
+		test_cache(cache, 0, copy, 65536, 1, "a copy of the text");
+		test_cache(cache, XPRESS_HUFF_DEFAULT_LEVEL, text, 65536, 1, "text at the default level");
+		test_cache(cache, XPRESS_HUFF_MIN_LEVEL, text, 65536, 0, "text at another level");
+		test_cache(cache, 0, text, 65535, 0, "text one byte shorter");
+		copy[65535] ^= 1;
+		test_cache(cache, 0, copy, 65536, 0, "text with its last byte changed");
+		copy[0] ^= 1;
+		test_cache(cache, 0, copy, 65536, 0, "text with its first byte changed");
+		test_cache(cache, 0, NULL, 0, 0, "nothing");
+		test_cache(cache, 0, NULL, 0, 1, "nothing again");
+	}
+	size_t out_len = 1;
+	TEST_CHECK(xpress_huff_cache_compress(cache, 0, text, 65536, block, &out_len) == ENOBUFS, "a hit fit in 1 byte");
+	TEST_CHECK(xpress_huff_cache_compress(cache, XPRESS_HUFF_MAX_LEVEL + 1, text, 65536, block, &out_len) == EINVAL, "an invalid level was accepted");
+	xpress_huff_cache_get_stats(cache, &stats);
+	TEST_CHECK(stats.entries == 6 && stats.evictions == 0, "%zu entries and %llu evictions instead of 6 and 0", stats.entries, (unsigned long long)stats.evictions);
+	xpress_huff_cache_clear(cache);
+	xpress_huff_cache_get_stats(cache, &stats);
+	TEST_CHECK(stats.entries == 0 && stats.hits == 5, "clearing left %zu entries and %llu hits", stats.entries, (unsigned long long)stats.hits);
+	test_cache(cache, 0, text, 65536, 0, "text after clearing");
+	xpress_huff_cache_free(cache);
+	free(text); free(copy);
+
+	////////// The least recently used results are dropped first //////////
+	// The memory of an empty cache (its lookup table) and of one block's result
+	cache = xpress_huff_cache_new(1 << 24);
+	TEST_CHECK(cache != NULL, "out of memory");
+	if (cache == NULL) { return test_done("cache"); }
+	xpress_huff_cache_get_stats(cache, &stats);
+	const size_t table = stats.memory;
+	test_cache(cache, 0, test_block(block, 0), BLOCK, 0, "block 0");
+	xpress_huff_cache_get_stats(cache, &stats);
+	const size_t entry = stats.memory - table;
+	xpress_huff_cache_free(cache);
+
+	// Room for 3 blocks: touching block 0 makes block 1 the least recently used
+	cache = xpress_huff_cache_new(table + 3 * entry);
+	TEST_CHECK(cache != NULL, "out of memory");
+	if (cache == NULL) { return test_done("cache"); }
+	for (uint8_t b = 0; b < 3; ++b) { test_cache(cache, 0, test_block(block, b), BLOCK, 0, "a new block"); }
+	test_cache(cache, 0, test_block(block, 0), BLOCK, 1, "block 0 again");
+	test_cache(cache, 0, test_block(block, 3), BLOCK, 0, "block 3");
+	test_cache(cache, 0, test_block(block, 0), BLOCK, 1, "block 0 after block 3");
+	test_cache(cache, 0, test_block(block, 2), BLOCK, 1, "block 2 after block 3");
+	test_cache(cache, 0, test_block(block, 3), BLOCK, 1, "block 3 again");
+	xpress_huff_cache_get_stats(cache, &stats);
+	TEST_CHECK(stats.evictions == 1 && stats.entries == 3 && stats.memory == table + 3 * entry, "%llu evictions, %zu entries and %zu bytes instead of 1, 3 and %zu",
+		(unsigned long long)stats.evictions, stats.entries, stats.memory, table + 3 * entry);
+	test_cache(cache, 0, test_block(block, 1), BLOCK, 0, "block 1, which was dropped");
+	xpress_huff_cache_free(cache);
+
+	////////// The memory limit //////////
+	// Each result is 1 byte less than the limit allows: it is compressed every time and never cached
+	cache = xpress_huff_cache_new(table + entry - 1);
+	TEST_CHECK(cache != NULL, "out of memory");
+	if (cache == NULL) { return test_done("cache"); }
+	test_cache(cache, 0, test_block(block, 0), BLOCK, 0, "a block that does not fit");
+	test_cache(cache, 0, test_block(block, 0), BLOCK, 0, "a block that does not fit again");
+	xpress_huff_cache_get_stats(cache, &stats);
+	TEST_CHECK(stats.entries == 0 && stats.memory == table, "a block over the limit was cached");
+	xpress_huff_cache_free(cache);
+
+	// More results than buckets fit, but the doubled lookup table does not: the chains get longer
+	const size_t buckets = table / sizeof(void*), limit = table + (buckets + 1) * entry + table / 2;
+	cache = xpress_huff_cache_new(limit);
+	TEST_CHECK(cache != NULL, "out of memory");
+	if (cache == NULL) { return test_done("cache"); }
+	for (size_t i = 0; i < 2 * buckets; ++i)
+	{
+		test_cache(cache, 0, test_block(block, (uint8_t)i), BLOCK, 0, "a block in a full cache");
+		xpress_huff_cache_get_stats(cache, &stats);
+		TEST_CHECK(stats.memory <= limit, "%zu bytes after %zu blocks are over the limit of %zu", stats.memory, i + 1, limit);
+	}
+	TEST_CHECK(stats.entries == buckets + 1 && stats.memory == table + (buckets + 1) * entry, "%zu entries in %zu bytes instead of %zu", stats.entries, stats.memory, buckets + 1);
+	test_cache(cache, 0, test_block(block, (uint8_t)(2 * buckets - 1)), BLOCK, 1, "the last block");
+	test_cache(cache, 0, test_block(block, (uint8_t)(buckets - 1)), BLOCK, 1, "the oldest block kept");
+	xpress_huff_cache_free(cache);
+
+	return test_done("cache");
+}
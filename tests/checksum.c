@@ -0,0 +1,103 @@
+// ms-compress: implements Microsoft compression algorithms
+// Copyright (C) 2018 David Mulder <dmulder@suse.com>
+//
+// This library is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This library is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+
+////////////////////////////// Checksum Test ///////////////////////////////////////////////////////
+// Checks xpress_huff_crc32c against the CRC-32C check value and a bitwise implementation at every
+// alignment, and that the checksums a context computes while compressing are those of its input and
+// of the output it wrote, also when compressing partially.
+
+#include "test.h"
+#include "../src/xpress_huff_compress.h"
+
+// CRC-32C one bit at a time (the reflected polynomial 0x1EDC6F41)
+static uint32_t test_crc32c(uint32_t crc, const uint8_t* data, size_t len)
+{
+	crc = ~crc;
+	for (size_t i = 0; i < len; ++i)
+	{
+		crc ^= data[i];
+		for (int b = 0; b < 8; ++b) { crc = (crc >> 1) ^ (0x82F63B78 & (0 - (crc & 1))); }
+	}
+	return ~crc;
+}
+
+// Compresses in (len bytes of the corpus) with the checksums set, partially into partial_len bytes
+// unless it is 0, and checks them against the input used and the output
+static void test_checksums(xpress_huff_ctx* ctx, unsigned checksums, corpus_type type, const uint8_t* in, size_t len, size_t partial_len)
+{
+	size_t out_len = partial_len ? partial_len : xpress_huff_max_compressed_size(len), in_used = len;
+	uint8_t* out = (uint8_t*)malloc(out_len);
+	TEST_CHECK(out != NULL, "out of memory");
+	if (out)
+	{
+		xpress_huff_ctx_set_checksums(ctx, checksums);
+		const int err = partial_len ? xpress_huff_compress_partial(ctx, in, len, out, &out_len, &in_used, NULL) : xpress_huff_compress_ctx(ctx, in, len, out, &out_len, NULL);
+		TEST_CHECK(err == 0, "%s of %zu bytes: error %d", corpus_names[type], len, err);
+		uint32_t in_crc = 1, out_crc = 1;
+		xpress_huff_ctx_get_checksums(ctx, &in_crc, &out_crc);
+		const uint32_t expected_in = (checksums & XPRESS_HUFF_CHECKSUM_INPUT) ? xpress_huff_crc32c(0, in, in_used) : 0;
+		const uint32_t expected_out = (checksums & XPRESS_HUFF_CHECKSUM_OUTPUT) ? xpress_huff_crc32c(0, out, out_len) : 0;
+		TEST_CHECK(err || in_crc == expected_in, "%s of %zu bytes (%zu used) with checksums %u: the input CRC is %08x instead of %08x", corpus_names[type], len, in_used, checksums, in_crc, expected_in);
+		TEST_CHECK(err || out_crc == expected_out, "%s of %zu bytes (%zu used) with checksums %u: the output CRC is %08x instead of %08x", corpus_names[type], len, in_used, checksums, out_crc, expected_out);
+	}
+	free(out);
+}
+
+int main(void)
+{
+	////////// The CRC itself //////////
+	TEST_CHECK(xpress_huff_crc32c(0, (const uint8_t*)"123456789", 9) == 0xE3069283, "the CRC of \"123456789\" is %08x", xpress_huff_crc32c(0, (const uint8_t*)"123456789", 9));
+	TEST_CHECK(xpress_huff_crc32c(xpress_huff_crc32c(0, (const uint8_t*)"1234", 4), (const uint8_t*)"56789", 5) == 0xE3069283, "the CRC did not continue");
+	TEST_CHECK(xpress_huff_crc32c(0, NULL, 0) == 0 && xpress_huff_crc32c(0x12345678, NULL, 0) == 0x12345678, "the CRC of nothing changed the CRC");
+	uint8_t* random = test_corpus(CORPUS_RANDOM, 4096);
+	for (size_t offset = 0; offset < 16; ++offset)
+	{
+		for (size_t len = 0; offset + len <= 4096; len += len < 64 ? 1 : 257)
+		{
+			const uint32_t crc = xpress_huff_crc32c(0, random + offset, len), expected = test_crc32c(0, random + offset, len);
+			TEST_CHECK(crc == expected, "the CRC of %zu bytes at offset %zu is %08x instead of %08x", len, offset, crc, expected);
+		}
+	}
+	free(random);
+
+	////////// The checksums of a compression //////////
+	xpress_huff_ctx* ctx = xpress_huff_ctx_new();
+	TEST_CHECK(ctx != NULL, "out of memory");
+	if (ctx == NULL) { return test_done("checksum"); }
+	for (int type = 0; type < CORPUS_COUNT; ++type)
+	{
+		for (size_t i = 0; i < TEST_SIZES; i += 2)
+		{
+			uint8_t* in = test_corpus((corpus_type)type, test_sizes[i]);
+			for (unsigned checksums = 0; checksums <= (XPRESS_HUFF_CHECKSUM_INPUT | XPRESS_HUFF_CHECKSUM_OUTPUT); ++checksums)
+			{
+				test_checksums(ctx, checksums, (corpus_type)type, in, test_sizes[i], 0);
+			}
+			free(in);
+		}
+	}
+
+	// Partially only the chunks that fit are checksummed, along with the end of stream chunk
+	uint8_t* text = test_corpus(CORPUS_TEXT, 500000);
+	for (size_t partial_len = 40000; partial_len < 240000; partial_len += 7919)
+	{
+		test_checksums(ctx, XPRESS_HUFF_CHECKSUM_INPUT | XPRESS_HUFF_CHECKSUM_OUTPUT, CORPUS_TEXT, text, 500000, partial_len);
+	}
+	free(text);
+	xpress_huff_ctx_free(ctx);
+	return test_done("checksum");
+}
@@ -0,0 +1,163 @@
+// ms-compress: implements Microsoft compression algorithms
+// Copyright (C) 2018 David Mulder <dmulder@suse.com>
+//
+// This library is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This library is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+
+
+////////////////////////////// Preset Dictionary Test //////////////////////////////////////////////
+// Compresses corpora with preset dictionaries of several lengths, including more than the 64 KiB that
+// matches can reach, and decompresses them with the dictionary as the history. A context that
+// switches between dictionaries, and back to none, has to compress as a new context would, and
+// contexts sharing a prepared dictionary have to compress as one that copied it.
+
+#include "test.h"
+#include "xpress_huff_decode.h"
+#include "../src/xpress_huff_compress.h"
+
+// Decompresses out (the compression of len bytes with dict_len bytes of dict before them) and checks
+// that it is in
+static int test_decompress(const uint8_t* dict, size_t dict_len, const uint8_t* in, size_t len, const uint8_t* out, size_t out_len)
+{
+	uint8_t* buf = (uint8_t*)malloc(dict_len + len);
+	if (buf == NULL) { return 0; }
+	memcpy(buf, dict, dict_len);
+	const int ok = test_xpress_huff_decompress_hist(out, out_len, buf, dict_len, len) == 0 && memcmp(in, buf + dict_len, len) == 0;
+	free(buf);
+	return ok;
+}
+
+// Compresses the corpus after a dictionary of the same type (but other data) with
+// xpress_huff_compress_with_dict and with a context, which have to agree, and returns the size
+static size_t test_round_trip(xpress_huff_ctx* ctx, corpus_type type, size_t dict_len, size_t len)
+{
+	uint8_t* dict = (uint8_t*)malloc(dict_len ? dict_len : 1), * in = test_corpus(type, len);
+	size_t out_len = xpress_huff_max_compressed_size(len), out_len2 = out_len;
+	uint8_t* out = (uint8_t*)malloc(out_len), * out2 = (uint8_t*)malloc(out_len);
+	TEST_CHECK(dict && out && out2, "out of memory");
+	if (!dict || !out || !out2) { free(dict); free(in); free(out); free(out2); return 0; }
+	corpus_generate(type, dict, dict_len, 2);
+
+	int err = xpress_huff_compress_with_dict(dict, dict_len, in, len, out, &out_len);
+	TEST_CHECK(err == 0, "%s of %zu bytes with a dictionary of %zu: error %d", corpus_names[type], len, dict_len, err);
+	TEST_CHECK(err || test_decompress(dict, dict_len, in, len, out, out_len), "%s of %zu bytes with a dictionary of %zu does not decompress", corpus_names[type], len, dict_len);
+	err = xpress_huff_ctx_set_dict(ctx, dict, dict_len);
+	err = err ? err : xpress_huff_compress_ctx(ctx, in, len, out2, &out_len2, NULL);
+	TEST_CHECK(err == 0 && out_len2 == out_len && memcmp(out, out2, out_len) == 0, "%s of %zu bytes with a dictionary of %zu: the context compressed differently",
+		corpus_names[type], len, dict_len);
+	free(dict); free(in); free(out); free(out2);
+	return out_len;
+}
+
+// Compresses the corpus with the context, which has to give the same as a new context without a
+// dictionary
+static void test_no_dict(xpress_huff_ctx* ctx, corpus_type type, size_t len)
+{
+	uint8_t* in = test_corpus(type, len);
+	size_t out_len = xpress_huff_max_compressed_size(len), out_len2 = out_len;
+	uint8_t* out = (uint8_t*)malloc(out_len), * out2 = (uint8_t*)malloc(out_len), * dec = (uint8_t*)malloc(len);
+	TEST_CHECK(out && out2 && dec, "out of memory");
+	if (out && out2 && dec)
+	{
+		int err = xpress_huff_compress(in, len, out, &out_len);
+		err = err ? err : xpress_huff_compress_ctx(ctx, in, len, out2, &out_len2, NULL);
+		TEST_CHECK(err == 0 && out_len2 == out_len && memcmp(out, out2, out_len) == 0, "%s of %zu bytes: the context without a dictionary compressed differently", corpus_names[type], len);
+		TEST_CHECK(err || (test_xpress_huff_decompress(out2, out_len2, dec, len) == 0 && memcmp(in, dec, len) == 0), "%s of %zu bytes does not decompress", corpus_names[type], len);
+	}
+	free(in); free(out); free(out2); free(dec);
+}
+
+// Compresses the corpus with two contexts that share the prepared dictionary (made from dict), which
+// have to agree with xpress_huff_compress_with_dict and decompress with dict as the history
+static void test_prepared(xpress_huff_ctx* ctx, xpress_huff_ctx* ctx2, const xpress_huff_dict* prepared, const uint8_t* dict, size_t dict_len, corpus_type type, size_t len)
+{
+	uint8_t* in = test_corpus(type, len);
+	size_t out_len = xpress_huff_max_compressed_size(len), out_len2 = out_len, out_len3 = out_len;
+	uint8_t* out = (uint8_t*)malloc(out_len), * out2 = (uint8_t*)malloc(out_len), * out3 = (uint8_t*)malloc(out_len);
+	TEST_CHECK(out && out2 && out3, "out of memory");
+	if (out && out2 && out3)
+	{
+		xpress_huff_ctx_use_dict(ctx, prepared);
+		xpress_huff_ctx_use_dict(ctx2, prepared);
+		int err = xpress_huff_compress_with_dict(dict, dict_len, in, len, out, &out_len);
+		err = err ? err : xpress_huff_compress_ctx(ctx, in, len, out2, &out_len2, NULL);
+		err = err ? err : xpress_huff_compress_ctx(ctx2, in, len, out3, &out_len3, NULL);
+		TEST_CHECK(err == 0, "%s of %zu bytes with a prepared dictionary of %zu: error %d", corpus_names[type], len, dict_len, err);
+		TEST_CHECK(err || (out_len2 == out_len && memcmp(out, out2, out_len) == 0), "%s of %zu bytes: the prepared dictionary of %zu compressed differently", corpus_names[type], len, dict_len);
+		TEST_CHECK(err || (out_len3 == out_len && memcmp(out, out3, out_len) == 0), "%s of %zu bytes: the contexts sharing a prepared dictionary of %zu disagree", corpus_names[type], len, dict_len);
+		TEST_CHECK(err || test_decompress(dict, dict_len, in, len, out2, out_len2), "%s of %zu bytes with a prepared dictionary of %zu does not decompress", corpus_names[type], len, dict_len);
+	}
+	free(in); free(out); free(out2); free(out3);
+}
+
+int main(void)
+{
+	static const size_t dict_lens[] = { 1, 100, 4096, 65535, 65536, 65537, 200000 }, sizes[] = { 1, 100, 4096, 65536, 65537, 200000 };
+	static const corpus_type types[] = { CORPUS_TEXT, CORPUS_RECORDS, CORPUS_RANDOM };
+	xpress_huff_ctx* ctx = xpress_huff_ctx_new();
+	TEST_CHECK(ctx != NULL, "out of memory");
+	if (ctx == NULL) { return test_done("dict"); }
+
+	// The same context switches to every dictionary
+	for (size_t t = 0; t < sizeof(types) / sizeof(*types); ++t)
+	{
+		for (size_t d = 0; d < sizeof(dict_lens) / sizeof(*dict_lens); ++d)
+		{
+			for (size_t i = 0; i < sizeof(sizes) / sizeof(*sizes); ++i) { test_round_trip(ctx, types[t], dict_lens[d], sizes[i]); }
+		}
+	}
+
+	// A message that continues the dictionary compresses better with it
+	uint8_t* text = test_corpus(CORPUS_TEXT, 65536 + 4096), out[8192];
+	size_t with = sizeof(out), without = sizeof(out);
+	TEST_CHECK(xpress_huff_compress_with_dict(text, 65536, text + 65536, 4096, out, &with) == 0 && test_decompress(text, 65536, text + 65536, 4096, out, with),
+		"4096 bytes of text after their dictionary do not decompress");
+	TEST_CHECK(xpress_huff_compress(text + 65536, 4096, out, &without) == 0 && with < without, "4096 bytes of text: %zu bytes with a dictionary, %zu without", with, without);
+	free(text);
+
+	// Going back to no dictionary, and to one again
+	TEST_CHECK(xpress_huff_ctx_set_dict(ctx, NULL, 0) == 0, "removing the dictionary failed");
+	for (size_t i = 0; i < sizeof(sizes) / sizeof(*sizes); ++i) { test_no_dict(ctx, CORPUS_RECORDS, sizes[i]); }
+	test_round_trip(ctx, CORPUS_RECORDS, 4096, 65537);
+	TEST_CHECK(xpress_huff_ctx_set_dict(ctx, (const uint8_t*)"", 0) == 0, "an empty dictionary was not accepted");
+	test_no_dict(ctx, CORPUS_TEXT, 200000);
+
+	// Two contexts share prepared dictionaries, switching between them and back to none
+	xpress_huff_ctx* ctx2 = xpress_huff_ctx_new();
+	uint8_t* dict = test_corpus(CORPUS_RECORDS, 100000), * dict2 = test_corpus(CORPUS_TEXT, 4096);
+	xpress_huff_dict* prepared = xpress_huff_dict_prepare(dict, 100000, 0), * prepared2 = xpress_huff_dict_prepare(dict2, 4096, 0);
+	TEST_CHECK(ctx2 && prepared && prepared2, "out of memory");
+	TEST_CHECK(xpress_huff_dict_prepare(dict, 0, 0) == NULL, "an empty dictionary was prepared");
+	if (ctx2 && prepared && prepared2)
+	{
+		for (size_t i = 0; i < sizeof(sizes) / sizeof(*sizes); ++i)
+		{
+			test_prepared(ctx, ctx2, prepared, dict, 100000, CORPUS_RECORDS, sizes[i]);
+			test_prepared(ctx, ctx2, prepared2, dict2, 4096, CORPUS_TEXT, sizes[i]);
+		}
+		test_prepared(ctx2, ctx, prepared, dict, 100000, CORPUS_TEXT, 65537);
+		xpress_huff_ctx_use_dict(ctx, NULL);
+		test_no_dict(ctx, CORPUS_RECORDS, 65537);
+		TEST_CHECK(xpress_huff_ctx_set_dict(ctx2, dict2, 4096) == 0, "out of memory");
+		xpress_huff_ctx_use_dict(ctx2, NULL); // frees the copy set above
+		test_no_dict(ctx2, CORPUS_TEXT, 4096);
+	}
+	xpress_huff_dict_free(prepared);
+	xpress_huff_dict_free(prepared2);
+	xpress_huff_ctx_free(ctx2);
+	free(dict); free(dict2);
+
+	xpress_huff_ctx_free(ctx);
+	return test_done("dict");
+}
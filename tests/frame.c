@@ -0,0 +1,99 @@
+// ms-compress: implements Microsoft compression algorithms
+// Copyright (C) 2018 David Mulder <dmulder@suse.com>
+//
+// This library is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This library is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+
+////////////////////////////// Frame Test //////////////////////////////////////////////////////////
+// Compresses corpora into frames and reads them back block by block, and checks that headers whose
+// size and number of blocks do not agree are rejected, including sizes where rounding the number of
+// blocks up would wrap around.
+
+#include "test.h"
+#include "xpress_huff_decode.h"
+#include "../src/xpress_huff_frame.h"
+#include "../src/xpress_huff_compress.h"
+
+#define TEST_BLOCK_SIZE		0x40000
+
+static void test_round_trip(corpus_type type, size_t len)
+{
+	size_t frame_len = xpress_huff_frame_max_size(len, TEST_BLOCK_SIZE);
+	uint8_t* in = test_corpus(type, len), * dec = (uint8_t*)malloc(len ? len : 1), * frame = (uint8_t*)malloc(frame_len);
+	TEST_CHECK(dec && frame, "out of memory");
+	if (!dec || !frame) { free(in); free(dec); free(frame); return; }
+	int err = xpress_huff_frame_compress(0, TEST_BLOCK_SIZE, in, len, frame, &frame_len);
+	TEST_CHECK(err == 0, "%s of %zu bytes: error %d", corpus_names[type], len, err);
+	xpress_huff_frame f;
+	err = err ? err : xpress_huff_frame_open(frame, frame_len, &f);
+	TEST_CHECK(err == 0, "%s of %zu bytes does not open: error %d", corpus_names[type], len, err);
+	if (err == 0)
+	{
+		TEST_CHECK(f.info.size == len && f.info.blocks == (len + TEST_BLOCK_SIZE - 1) / TEST_BLOCK_SIZE, "%s of %zu bytes: size %llu in %u blocks", corpus_names[type], len, (unsigned long long)f.info.size, f.info.blocks);
+		for (uint32_t i = 0; i < f.info.blocks; ++i)
+		{
+			xpress_huff_frame_block b;
+			err = xpress_huff_frame_get_block(&f, i, &b);
+			TEST_CHECK(err == 0 && xpress_huff_frame_verify_block(&b) == 0, "%s of %zu bytes: block %u: error %d", corpus_names[type], len, i, err);
+			if (err || b.offset + b.orig_len > len) { continue; }
+			uint8_t* out = dec + b.offset;
+			if (b.stored) { memcpy(out, b.data, b.orig_len); }
+			else { TEST_CHECK(test_xpress_huff_decompress(b.data, b.comp_len, out, b.orig_len) == 0, "%s of %zu bytes: block %u does not decompress", corpus_names[type], len, i); }
+			TEST_CHECK(xpress_huff_crc32c(0, out, b.orig_len) == b.orig_crc, "%s of %zu bytes: block %u has the wrong CRC", corpus_names[type], len, i);
+		}
+		TEST_CHECK(memcmp(in, dec, len) == 0, "%s of %zu bytes does not decompress", corpus_names[type], len);
+	}
+	free(in); free(dec); free(frame);
+}
+
+// Reads a copy of header with the given size, block size and number of blocks (and a matching CRC)
+static int test_header(const uint8_t* header, uint64_t size, uint32_t block_size, uint32_t blocks, xpress_huff_frame_info* info)
+{
+	uint8_t h[XPRESS_HUFF_FRAME_HEADER_SIZE];
+	memcpy(h, header, sizeof(h));
+	SET_UINT32(h + 8, block_size);
+	SET_UINT32(h + 12, blocks);
+	SET_UINT32(h + 16, (uint32_t)size);
+	SET_UINT32(h + 20, (uint32_t)(size >> 32));
+	SET_UINT32(h + 28, xpress_huff_crc32c(0, h, 28));
+	return xpress_huff_frame_read_header(h, sizeof(h), info);
+}
+
+int main(void)
+{
+	static const size_t sizes[] = { 0, 1, 65536, TEST_BLOCK_SIZE, TEST_BLOCK_SIZE + 1, 3 * TEST_BLOCK_SIZE + 100 };
+	for (int type = 0; type < CORPUS_COUNT; ++type)
+	{
+		for (size_t i = 0; i < sizeof(sizes) / sizeof(*sizes); ++i) { test_round_trip((corpus_type)type, sizes[i]); }
+	}
+
+	// A header to change the sizes of
+	uint8_t frame[XPRESS_HUFF_FRAME_HEADER_SIZE + 64], in[1] = { 0 };
+	size_t frame_len = sizeof(frame);
+	TEST_CHECK(xpress_huff_frame_compress(0, 0, in, sizeof(in), frame, &frame_len) == 0, "a frame of 1 byte did not compress");
+	xpress_huff_frame_info info;
+	TEST_CHECK(test_header(frame, 0, 0x10000, 0, &info) == 0, "an empty frame was rejected");
+	TEST_CHECK(test_header(frame, 0x10001, 0x10000, 2, &info) == 0 && info.chunks == 2, "2 blocks of 64 KiB + 1 were rejected");
+	TEST_CHECK(test_header(frame, 0x10001, 0x10000, 1, &info) == EINVAL, "1 block of 64 KiB + 1 was accepted");
+	TEST_CHECK(test_header(frame, 0x10000, 0x10001, 1, &info) == EINVAL, "a block size that is not a multiple of 64 KiB was accepted");
+	TEST_CHECK(test_header(frame, (uint64_t)UINT32_MAX << 16, 0x10000, UINT32_MAX, &info) == 0 && info.chunks == UINT32_MAX, "the most blocks of 64 KiB were rejected");
+
+	// Rounding these sizes up to whole blocks wraps around
+	TEST_CHECK(test_header(frame, UINT64_MAX, 0x10000, 0, &info) == EINVAL, "2^64-1 bytes in 0 blocks was accepted");
+	TEST_CHECK(test_header(frame, UINT64_MAX, 0x10000, UINT32_MAX, &info) == EINVAL, "2^64-1 bytes in 2^32-1 blocks of 64 KiB was accepted");
+	TEST_CHECK(test_header(frame, UINT64_MAX - 0xFFFF, 0xFFFF0000, 0, &info) == EINVAL, "2^64-2^16 bytes in 0 blocks was accepted");
+	TEST_CHECK(xpress_huff_chunk_count(UINT64_MAX) == (UINT64_MAX >> 16) + 1, "%llu chunks for 2^64-1 bytes", (unsigned long long)xpress_huff_chunk_count(UINT64_MAX));
+
+	return test_done("frame");
+}
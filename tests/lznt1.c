@@ -0,0 +1,154 @@
+// ms-compress: implements Microsoft compression algorithms
+// Copyright (C) 2018 David Mulder <dmulder@suse.com>
+//
+// This library is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This library is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+
+////////////////////////////// LZNT1 Test //////////////////////////////////////////////////////////
+// Compresses every corpus at every test size with lznt1_compress and checks that lznt1_decompress
+// gives back the input, that both fail with ENOBUFS when the output is one byte too small, and that
+// lznt1_decompress rejects truncated data, matches reaching before the start of a chunk and chunks
+// decompressing to more than 4096 bytes.
+
+#include "test.h"
+#include "../src/lznt1.h"
+
+static void test_round_trip(corpus_type type, size_t len)
+{
+	const size_t max_len = lznt1_max_compressed_size(len);
+	uint8_t* in = test_corpus(type, len), * dec = (uint8_t*)malloc(len), * out = (uint8_t*)malloc(max_len), * out2 = (uint8_t*)malloc(max_len);
+	TEST_CHECK(dec && out && out2, "out of memory");
+	if (dec && out && out2)
+	{
+		size_t out_len = max_len, dec_len = len;
+		int err = lznt1_compress(in, len, out, &out_len);
+		TEST_CHECK(err == 0, "%s of %zu bytes: error %d", corpus_names[type], len, err);
+		if (err == 0)
+		{
+			TEST_CHECK(out_len <= max_len, "%s of %zu bytes: %zu bytes is over the maximum of %zu", corpus_names[type], len, out_len, max_len);
+			err = lznt1_decompress(out, out_len, dec, &dec_len);
+			TEST_CHECK(err == 0 && dec_len == len && memcmp(in, dec, len) == 0, "%s of %zu bytes does not decompress: error %d", corpus_names[type], len, err);
+			dec_len = len - 1;
+			err = lznt1_decompress(out, out_len, dec, &dec_len);
+			TEST_CHECK(err == ENOBUFS, "%s of %zu bytes decompressed into %zu bytes: error %d", corpus_names[type], len, len - 1, err);
+
+			size_t out2_len = out_len;
+			err = lznt1_compress(in, len, out2, &out2_len);
+			TEST_CHECK(err == 0 && out2_len == out_len && memcmp(out, out2, out_len) == 0, "%s of %zu bytes into exactly %zu bytes: error %d", corpus_names[type], len, out_len, err);
+			out2_len = out_len - 1;
+			err = lznt1_compress(in, len, out2, &out2_len);
+			TEST_CHECK(err == ENOBUFS, "%s of %zu bytes into %zu bytes: error %d", corpus_names[type], len, out_len - 1, err);
+		}
+	}
+	free(in); free(dec); free(out); free(out2);
+}
+
+// Every prefix of a compressed stream either ends between chunks (maybe with a stray byte, which is
+// ignored) and gives the chunks before it, or ends inside a chunk and is invalid
+static void test_truncated(corpus_type type, size_t len)
+{
+	const size_t max_len = lznt1_max_compressed_size(len);
+	uint8_t* in = test_corpus(type, len), * dec = (uint8_t*)malloc(len), * out = (uint8_t*)malloc(max_len);
+	size_t out_len = max_len;
+	const int ok = dec && out && lznt1_compress(in, len, out, &out_len) == 0;
+	TEST_CHECK(ok, "%s of %zu bytes did not compress", corpus_names[type], len);
+	size_t chunk = 0, chunks = 0; // the start of the chunk the prefix ends in and the number of chunks before it
+	for (size_t n = 0; ok && n <= out_len; ++n)
+	{
+		while (chunk + 2 <= out_len && n >= chunk + 2 + (GET_UINT16(out + chunk) & 0xFFF) + 1) { chunk += 2 + (GET_UINT16(out + chunk) & 0xFFF) + 1; ++chunks; }
+		size_t dec_len = len;
+		const int err = lznt1_decompress(out, n, dec, &dec_len);
+		if (n < chunk + 2)
+		{
+			const size_t expected = MIN(chunks * 0x1000, len);
+			TEST_CHECK(err == 0 && dec_len == expected && memcmp(in, dec, dec_len) == 0, "%s of %zu bytes cut to %zu bytes: error %d, %zu bytes", corpus_names[type], len, n, err, dec_len);
+		}
+		else
+		{
+			TEST_CHECK(err == EINVAL, "%s of %zu bytes cut to %zu bytes inside a chunk: error %d", corpus_names[type], len, n, err);
+		}
+	}
+	free(in); free(dec); free(out);
+}
+
+// Decompresses in into a buffer of exactly out_len bytes (so that writing past it is caught by
+// memory checkers), returning the error and, when there is none, comparing the output with expected
+static int test_decompress(const uint8_t* in, size_t in_len, size_t out_len, const void* expected, size_t expected_len)
+{
+	uint8_t* out = (uint8_t*)malloc(out_len ? out_len : 1);
+	if (out == NULL) { fprintf(stderr, "out of memory\n"); exit(2); }
+	const int err = lznt1_decompress(in, in_len, out, &out_len);
+	TEST_CHECK(err || !expected || (out_len == expected_len && memcmp(out, expected, out_len) == 0), "decompressed to \"%.*s\"", (int)out_len, out);
+	free(out);
+	return err;
+}
+
+int main(void)
+{
+	for (int type = 0; type < CORPUS_COUNT; ++type)
+	{
+		for (size_t i = 0; i < TEST_SIZES; ++i) { test_round_trip((corpus_type)type, test_sizes[i]); }
+		test_truncated((corpus_type)type, 3 * 0x1000 + 100);
+	}
+
+	// The example of MS-XCA 3.2, which decompresses to a string including its terminating 0
+	static const uint8_t example[] =
+	{
+		0x38, 0xb0, 0x88, 0x46, 0x23, 0x20, 0x00, 0x20, 0x47, 0x20, 0x41, 0x00, 0x10, 0xa2, 0x47, 0x01,
+		0xa0, 0x45, 0x20, 0x44, 0x00, 0x08, 0x45, 0x01, 0x50, 0x79, 0x00, 0xc0, 0x45, 0x20, 0x05, 0x24,
+		0x13, 0x88, 0x05, 0xb4, 0x02, 0x4a, 0x44, 0xef, 0x03, 0x58, 0x02, 0x8c, 0x09, 0x16, 0x01, 0x48,
+		0x45, 0x00, 0xbe, 0x00, 0x9e, 0x00, 0x04, 0x01, 0x18, 0x90, 0x00, 0x00,
+	};
+	static const char example_out[] = "F# F# G A A G F# E D D E F# F# E E F# F# G A A G F# E D D E F# E D D E E F# D E F# G F# D E F# G F# E D E A F# F# G A A G F# E D D E F# E D D";
+	TEST_CHECK(test_decompress(example, sizeof(example), 200, example_out, sizeof(example_out)) == 0, "the example did not decompress");
+	TEST_CHECK(test_decompress(example, sizeof(example), sizeof(example_out) - 1, NULL, 0) == ENOBUFS, "the example fit in one byte less");
+
+	// A match with an offset of 1 right after the first literal is fine, one of 2 reaches before the chunk
+	static const uint8_t offset_1[] = { 0x03, 0xB0, 0x02, 'a', 0x00, 0x00 }, offset_2[] = { 0x03, 0xB0, 0x02, 'a', 0x00, 0x10 };
+	TEST_CHECK(test_decompress(offset_1, sizeof(offset_1), 16, "aaaa", 4) == 0, "a match with an offset of 1 failed");
+	TEST_CHECK(test_decompress(offset_2, sizeof(offset_2), 16, NULL, 0) == EINVAL, "a match with an offset of 2 after 1 byte did not fail");
+
+	// Chunks do not share their history, so neither can the second chunk refer to the first
+	static const uint8_t second_chunk[] = { 0x00, 0x30, 'a', 0x02, 0xB0, 0x01, 0x00, 0x00 };
+	TEST_CHECK(test_decompress(second_chunk, sizeof(second_chunk), 16, NULL, 0) == EINVAL, "a match before the start of the second chunk did not fail");
+
+	// A chunk decompresses to at most 4096 bytes: a literal and a match of 4095 fill it, a longer
+	// match or another literal goes past it
+	static const uint8_t full_chunk[] = { 0x03, 0xB0, 0x02, 'a', 0xFC, 0x0F }, long_match[] = { 0x03, 0xB0, 0x02, 'a', 0xFF, 0x0F }, extra_literal[] = { 0x04, 0xB0, 0x02, 'a', 0xFC, 0x0F, 'b' };
+	static uint8_t a_4096[0x1000];
+	memset(a_4096, 'a', sizeof(a_4096));
+	TEST_CHECK(test_decompress(full_chunk, sizeof(full_chunk), 0x2000, a_4096, sizeof(a_4096)) == 0, "a chunk of 4096 bytes failed");
+	TEST_CHECK(test_decompress(long_match, sizeof(long_match), 0x2000, NULL, 0) == EINVAL, "a match past the end of the chunk did not fail");
+	TEST_CHECK(test_decompress(extra_literal, sizeof(extra_literal), 0x2000, NULL, 0) == EINVAL, "a literal past the end of the chunk did not fail");
+
+	// A chunk that is cut short, a match without its second byte, and a chunk header of 0 ending the data
+	static const uint8_t short_chunk[] = { 0x10, 0xB0, 0x00, 'a', 'b' }, short_match[] = { 0x02, 0xB0, 0x02, 'a', 0x00 }, end[] = { 0x00, 0x30, 'a', 0x00, 0x00, 0x05, 0x30 };
+	TEST_CHECK(test_decompress(short_chunk, sizeof(short_chunk), 16, NULL, 0) == EINVAL, "a short chunk did not fail");
+	TEST_CHECK(test_decompress(short_match, sizeof(short_match), 16, NULL, 0) == EINVAL, "a short match did not fail");
+	TEST_CHECK(test_decompress(end, sizeof(end), 16, "a", 1) == 0, "the data did not end at a chunk header of 0");
+
+	// Random data must only ever be rejected, never read or written out of bounds
+	bench_rng r;
+	bench_rng_seed(&r, 1);
+	for (unsigned i = 0; i < 20000; ++i)
+	{
+		uint8_t garbage[300];
+		const size_t garbage_len = bench_rng_below(&r, sizeof(garbage));
+		for (size_t j = 0; j < garbage_len; ++j) { garbage[j] = (uint8_t)bench_rng_next(&r); }
+		if (garbage_len >= 2 && (i & 1)) { garbage[1] = (garbage[1] & 0x8F) | 0x30; } // a valid signature
+		test_decompress(garbage, garbage_len, bench_rng_below(&r, 5000), NULL, 0);
+	}
+
+	return test_done("lznt1");
+}
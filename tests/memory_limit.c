@@ -0,0 +1,113 @@
+// ms-compress: implements Microsoft compression algorithms
+// Copyright (C) 2018 David Mulder <dmulder@suse.com>
+//
+// This library is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This library is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+
+////////////////////////////// Memory Limit Test ///////////////////////////////////////////////////
+// Compresses with memory limits of a few hundred KiB, counting the bytes the context allocates, and
+// checks that the limit is kept, that the output decompresses to the input and that the memory
+// usage functions agree with what is allocated.
+
+#include "test.h"
+#include "xpress_huff_decode.h"
+#include "../src/xpress_huff_compress.h"
+
+////////// Counting Allocator //////////
+// Every block starts with its size so that free can take it off of the count
+#define TEST_ALLOC_HEADER	16
+
+typedef struct { size_t current, peak; } test_usage;
+
+static void* test_alloc(void* opaque, size_t size)
+{
+	test_usage* u = (test_usage*)opaque;
+	uint8_t* p = (uint8_t*)malloc(TEST_ALLOC_HEADER + size);
+	if (p == NULL) { return NULL; }
+	memcpy(p, &size, sizeof(size));
+	u->current += size;
+	u->peak = MAX(u->peak, u->current);
+	return p + TEST_ALLOC_HEADER;
+}
+
+static void test_free(void* opaque, void* ptr)
+{
+	test_usage* u = (test_usage*)opaque;
+	uint8_t* p = (uint8_t*)ptr - TEST_ALLOC_HEADER;
+	size_t size;
+	memcpy(&size, p, sizeof(size));
+	u->current -= size;
+	free(p);
+}
+
+// Compresses the corpus with a new context at the level and limit, checking the limit, the output
+// and (without a limit) that xpress_huff_memory_usage is the actual peak
+static void test_limit(corpus_type type, size_t len, int level, size_t limit)
+{
+	test_usage usage = { 0, 0 };
+	const mscomp_allocator allocator = { test_alloc, test_free, &usage };
+	uint8_t* in = test_corpus(type, len), * dec = (uint8_t*)malloc(len);
+	size_t out_len = xpress_huff_max_compressed_size(len);
+	uint8_t* out = (uint8_t*)malloc(out_len);
+	xpress_huff_ctx* ctx = xpress_huff_ctx_new_with_allocator(&allocator);
+	TEST_CHECK(ctx && out && dec, "out of memory");
+	if (ctx && out && dec)
+	{
+		xpress_huff_ctx_set_level(ctx, level);
+		xpress_huff_ctx_set_memory_limit(ctx, limit);
+		const int err = xpress_huff_compress_ctx(ctx, in, len, out, &out_len, NULL);
+		TEST_CHECK(err == 0, "%s of %zu bytes at level %d with a limit of %zu: error %d", corpus_names[type], len, level, limit, err);
+		TEST_CHECK(err || (test_xpress_huff_decompress(out, out_len, dec, len) == 0 && memcmp(in, dec, len) == 0),
+			"%s of %zu bytes at level %d with a limit of %zu does not decompress", corpus_names[type], len, level, limit);
+		TEST_CHECK(limit == 0 || usage.peak <= limit, "%s of %zu bytes at level %d allocated %zu bytes, over the limit of %zu", corpus_names[type], len, level, usage.peak, limit);
+		TEST_CHECK(limit != 0 || usage.peak == xpress_huff_memory_usage(level, 1, len),
+			"%s of %zu bytes at level %d allocated %zu bytes, reported %zu", corpus_names[type], len, level, usage.peak, xpress_huff_memory_usage(level, 1, len));
+	}
+	xpress_huff_ctx_free(ctx);
+	TEST_CHECK(usage.current == 0, "%zu bytes not freed", usage.current);
+	free(in); free(dec); free(out);
+}
+
+int main(void)
+{
+	static const size_t small_sizes[] = { 1, 100, 4096, 32768 }, large_sizes[] = { 65537, 1 << 20 };
+	for (int level = XPRESS_HUFF_MIN_LEVEL; level <= XPRESS_HUFF_MAX_LEVEL; ++level)
+	{
+		for (int type = 0; type < CORPUS_COUNT; ++type)
+		{
+			// Small inputs fit in 200 KB, large ones (with a window of two chunks) in 640 KiB
+			for (size_t i = 0; i < sizeof(small_sizes) / sizeof(*small_sizes); ++i) { test_limit((corpus_type)type, small_sizes[i], level, 200000); }
+			for (size_t i = 0; i < sizeof(large_sizes) / sizeof(*large_sizes); ++i) { test_limit((corpus_type)type, large_sizes[i], level, 640 << 10); }
+		}
+		test_limit(CORPUS_TEXT, 1 << 20, level, 0);
+	}
+
+	// A limit smaller than the context itself cannot be met
+	test_usage usage = { 0, 0 };
+	const mscomp_allocator allocator = { test_alloc, test_free, &usage };
+	xpress_huff_ctx* ctx = xpress_huff_ctx_new_with_allocator(&allocator);
+	uint8_t in[100] = { 0 }, out[200];
+	size_t out_len = sizeof(out);
+	xpress_huff_ctx_set_memory_limit(ctx, 1000);
+	TEST_CHECK(xpress_huff_compress_ctx(ctx, in, sizeof(in), out, &out_len, NULL) == ENOMEM, "a limit of 1000 bytes was met");
+	xpress_huff_ctx_free(ctx);
+
+	// Even a budget of 1 MiB fits one compression of 1 MiB
+	TEST_CHECK(xpress_huff_threads_for_memory(64, 1 << 20, 1 << 20) == 1, "%u threads", xpress_huff_threads_for_memory(64, 1 << 20, 1 << 20));
+	TEST_CHECK(xpress_huff_threads_for_memory(4, 1 << 20, 4 << 20) == 4, "%u threads", xpress_huff_threads_for_memory(4, 1 << 20, 4 << 20));
+	TEST_CHECK(xpress_huff_threads_for_memory(16, 4096, 1 << 20) == 16, "%u threads", xpress_huff_threads_for_memory(16, 4096, 1 << 20));
+	TEST_CHECK(xpress_huff_memory_usage(1, 1, 1) < 64 << 10, "%zu bytes for 1 byte", xpress_huff_memory_usage(1, 1, 1));
+
+	return test_done("memory_limit");
+}
@@ -0,0 +1,85 @@
+// ms-compress: implements Microsoft compression algorithms
+// Copyright (C) 2018 David Mulder <dmulder@suse.com>
+//
+// This library is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This library is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+
+////////////////////////////// Partial Compression Test ////////////////////////////////////////////
+// Compresses corpora with xpress_huff_compress_partial into every output size from the 260 byte
+// minimum up to the full compressed size and checks that the output decompresses to exactly the
+// first *in_used bytes, that more room never uses less input and that the full size uses all of it.
+
+#include "test.h"
+#include "xpress_huff_decode.h"
+#include "../src/xpress_huff_compress.h"
+
+static void test_partial(xpress_huff_ctx* ctx, corpus_type type, size_t len, size_t step)
+{
+	uint8_t* in = test_corpus(type, len);
+	size_t full_len = xpress_huff_max_compressed_size(len);
+	uint8_t* full = (uint8_t*)malloc(full_len), * out = (uint8_t*)malloc(full_len + 1), * dec = (uint8_t*)malloc(len);
+	TEST_CHECK(full && out && dec, "out of memory");
+	const int err = (full && out && dec) ? xpress_huff_compress(in, len, full, &full_len) : ENOMEM;
+	TEST_CHECK(err == 0, "%s of %zu bytes: error %d", corpus_names[type], len, err);
+	if (err == 0)
+	{
+		// Nothing fits below the minimum
+		for (size_t out_len = 0; out_len < 260; out_len += 37)
+		{
+			size_t n = out_len, in_used = 1;
+			TEST_CHECK(xpress_huff_compress_partial(ctx, in, len, out, &n, &in_used, NULL) == ENOBUFS, "%s of %zu bytes fit in %zu bytes", corpus_names[type], len, out_len);
+		}
+
+		size_t last_used = 0;
+		for (size_t out_len = 260; out_len <= full_len + 1; out_len = (out_len < full_len && out_len + step > full_len) ? full_len : out_len + step)
+		{
+			size_t n = out_len, in_used = 0;
+			const int e = xpress_huff_compress_partial(ctx, in, len, out, &n, &in_used, NULL);
+			if (e == ENOBUFS)
+			{
+				TEST_CHECK(last_used == 0, "%s of %zu bytes: nothing fit in %zu bytes after %zu bytes of input did in less", corpus_names[type], len, out_len, last_used);
+				continue;
+			}
+			TEST_CHECK(e == 0, "%s of %zu bytes into %zu bytes: error %d", corpus_names[type], len, out_len, e);
+			if (e) { continue; }
+			TEST_CHECK(n <= out_len && in_used > 0 && in_used <= len && (in_used == len || in_used % XPRESS_HUFF_CHUNK_SIZE == 0),
+				"%s of %zu bytes into %zu bytes: wrote %zu bytes for %zu bytes of input", corpus_names[type], len, out_len, n, in_used);
+			TEST_CHECK(in_used >= last_used, "%s of %zu bytes: %zu bytes used %zu bytes of input, less bytes used %zu", corpus_names[type], len, out_len, in_used, last_used);
+			TEST_CHECK(out_len < full_len || in_used == len, "%s of %zu bytes: %zu bytes, at least the full %zu, only used %zu bytes", corpus_names[type], len, out_len, full_len, in_used);
+			TEST_CHECK(in_used > len || (test_xpress_huff_decompress(out, n, dec, in_used) == 0 && memcmp(in, dec, in_used) == 0),
+				"%s of %zu bytes into %zu bytes does not decompress to its first %zu bytes", corpus_names[type], len, out_len, in_used);
+			last_used = in_used;
+		}
+		TEST_CHECK(last_used == len, "%s of %zu bytes never used all of the input", corpus_names[type], len);
+	}
+	free(in); free(full); free(out); free(dec);
+}
+
+int main(void)
+{
+	xpress_huff_ctx* ctx = xpress_huff_ctx_new();
+	TEST_CHECK(ctx != NULL, "out of memory");
+	if (ctx == NULL) { return test_done("partial"); }
+	static const corpus_type types[] = { CORPUS_TEXT, CORPUS_RECORDS, CORPUS_RANDOM };
+	for (size_t t = 0; t < sizeof(types) / sizeof(*types); ++t)
+	{
+		test_partial(ctx, types[t], 1, 1);
+		test_partial(ctx, types[t], 4096, 7);
+		test_partial(ctx, types[t], XPRESS_HUFF_CHUNK_SIZE, 127);
+		test_partial(ctx, types[t], XPRESS_HUFF_CHUNK_SIZE + 1, 127);
+		test_partial(ctx, types[t], 3 * XPRESS_HUFF_CHUNK_SIZE + 100, 1021);
+	}
+	xpress_huff_ctx_free(ctx);
+	return test_done("partial");
+}
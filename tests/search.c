@@ -0,0 +1,78 @@
+// ms-compress: implements Microsoft compression algorithms
+// Copyright (C) 2018 David Mulder <dmulder@suse.com>
+//
+// This library is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This library is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+
+////////////////////////////// Match Search Test ///////////////////////////////////////////////////
+// Compresses every corpus with each of the optional match search settings of a context (the adaptive
+// chain depth and picking matches by their cost) at the fastest and the best level and checks that the
+// output decompresses and that a context reused for every compression gives the same output as a new one.
+
+#include "test.h"
+#include "xpress_huff_decode.h"
+#include "../src/xpress_huff_compress.h"
+
+typedef void (*test_setting_fn)(xpress_huff_ctx* ctx, int enable);
+
+// Compresses in (len bytes of the corpus) with only the setting enabled at the level, with the reused
+// context and a new one
+static void test_search(xpress_huff_ctx* reused, test_setting_fn setting, const char* name, int level, corpus_type type, const uint8_t* in, size_t len)
+{
+	size_t out_len = xpress_huff_max_compressed_size(len), out_len2 = out_len;
+	uint8_t* out = (uint8_t*)malloc(out_len), * out2 = (uint8_t*)malloc(out_len), * dec = (uint8_t*)malloc(len);
+	xpress_huff_ctx* ctx = xpress_huff_ctx_new();
+	TEST_CHECK(out && out2 && dec && ctx, "out of memory");
+	if (out && out2 && dec && ctx)
+	{
+		xpress_huff_ctx_set_adaptive_chain(reused, 0);
+		xpress_huff_ctx_set_match_costs(reused, 0);
+		setting(ctx, 1);
+		setting(reused, 1);
+		int err = xpress_huff_ctx_set_level(ctx, level);
+		err = err ? err : xpress_huff_ctx_set_level(reused, level);
+		err = err ? err : xpress_huff_compress_ctx(ctx, in, len, out, &out_len, NULL);
+		err = err ? err : xpress_huff_compress_ctx(reused, in, len, out2, &out_len2, NULL);
+		TEST_CHECK(err == 0, "%s of %zu bytes with the %s at level %d: error %d", corpus_names[type], len, name, level, err);
+		TEST_CHECK(err || (test_xpress_huff_decompress(out, out_len, dec, len) == 0 && memcmp(in, dec, len) == 0),
+			"%s of %zu bytes with the %s at level %d does not decompress", corpus_names[type], len, name, level);
+		TEST_CHECK(err || (out_len2 == out_len && memcmp(out, out2, out_len) == 0),
+			"%s of %zu bytes with the %s at level %d: the reused context compressed differently", corpus_names[type], len, name, level);
+	}
+	xpress_huff_ctx_free(ctx);
+	free(out); free(out2); free(dec);
+}
+
+int main(void)
+{
+	static const int levels[] = { XPRESS_HUFF_MIN_LEVEL, XPRESS_HUFF_MAX_LEVEL };
+	xpress_huff_ctx* reused = xpress_huff_ctx_new();
+	TEST_CHECK(reused != NULL, "out of memory");
+	if (reused == NULL) { return test_done("search"); }
+	for (int type = 0; type < CORPUS_COUNT; ++type)
+	{
+		for (size_t i = 0; i < TEST_SIZES; i += 2)
+		{
+			uint8_t* in = test_corpus((corpus_type)type, test_sizes[i]);
+			for (size_t l = 0; l < sizeof(levels) / sizeof(*levels); ++l)
+			{
+				test_search(reused, xpress_huff_ctx_set_adaptive_chain, "adaptive chain", levels[l], (corpus_type)type, in, test_sizes[i]);
+				test_search(reused, xpress_huff_ctx_set_match_costs, "match costs", levels[l], (corpus_type)type, in, test_sizes[i]);
+			}
+			free(in);
+		}
+	}
+	xpress_huff_ctx_free(reused);
+	return test_done("search");
+}
@@ -0,0 +1,102 @@
+// ms-compress: implements Microsoft compression algorithms
+// Copyright (C) 2018 David Mulder <dmulder@suse.com>
+//
+// This library is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This library is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+
+
+////////////////////////////// Statistics Test /////////////////////////////////////////////////////
+// Compresses corpora with statistics and checks that the totals match the call: the input and output
+// sizes, the number of chunks and the sums of the per-chunk statistics. A reused context has to report
+// the same as a new one, so nothing may carry over from the calls before.
+
+#include "test.h"
+#include "xpress_huff_decode.h"
+#include "../src/xpress_huff_compress.h"
+
+#define TEST_CHUNK_STATS	32
+
+static void test_stats(xpress_huff_ctx* reused, corpus_type type, size_t len)
+{
+	uint8_t* in = test_corpus(type, len);
+	size_t out_len = xpress_huff_max_compressed_size(len), out_len2 = out_len;
+	uint8_t* out = (uint8_t*)malloc(out_len), * out2 = (uint8_t*)malloc(out_len), * dec = (uint8_t*)malloc(len);
+	xpress_huff_ctx* ctx = xpress_huff_ctx_new();
+	TEST_CHECK(ctx && out && out2 && dec, "out of memory");
+	if (!ctx || !out || !out2 || !dec) { xpress_huff_ctx_free(ctx); free(in); free(out); free(out2); free(dec); return; }
+
+	xpress_huff_chunk_stats chunk_stats[TEST_CHUNK_STATS];
+	xpress_huff_stats stats, stats2;
+	stats.chunk_stats = chunk_stats;
+	stats.chunk_stats_cap = TEST_CHUNK_STATS;
+	stats2.chunk_stats = NULL;
+	stats2.chunk_stats_cap = 0;
+	int err = xpress_huff_compress_ctx(ctx, in, len, out, &out_len, &stats);
+	TEST_CHECK(err == 0, "%s of %zu bytes: error %d", corpus_names[type], len, err);
+	if (err == 0)
+	{
+		TEST_CHECK(stats.in_len == len && stats.out_len == out_len, "%s of %zu bytes: %llu bytes in, %llu out, the call compressed to %zu",
+			corpus_names[type], len, (unsigned long long)stats.in_len, (unsigned long long)stats.out_len, out_len);
+		TEST_CHECK(stats.chunks == xpress_huff_chunk_count(len), "%s of %zu bytes: %u chunks", corpus_names[type], len, stats.chunks);
+		TEST_CHECK(stats.literals + 3 * stats.matches <= len && stats.fallback_chunks <= stats.chunks && stats.budget_chunks == 0,
+			"%s of %zu bytes: %llu literals, %llu matches", corpus_names[type], len, (unsigned long long)stats.literals, (unsigned long long)stats.matches);
+		TEST_CHECK(test_xpress_huff_decompress(out, out_len, dec, len) == 0 && memcmp(in, dec, len) == 0, "%s of %zu bytes does not decompress", corpus_names[type], len);
+
+		// The chunks that were recorded add up to the totals
+		uint64_t in_sum = 0, out_sum = 0, literals = 0, matches = 0, finds = 0;
+		for (uint32_t i = 0; i < MIN(stats.chunks, TEST_CHUNK_STATS); ++i)
+		{
+			TEST_CHECK(chunk_stats[i].in_len == MIN(len - (size_t)i * XPRESS_HUFF_CHUNK_SIZE, XPRESS_HUFF_CHUNK_SIZE), "%s of %zu bytes: chunk %u has %zu bytes",
+				corpus_names[type], len, i, chunk_stats[i].in_len);
+			in_sum += chunk_stats[i].in_len; out_sum += chunk_stats[i].out_len;
+			literals += chunk_stats[i].literals; matches += chunk_stats[i].matches; finds += chunk_stats[i].finds;
+		}
+		if (stats.chunks <= TEST_CHUNK_STATS)
+		{
+			TEST_CHECK(in_sum == stats.in_len && out_sum == stats.out_len && literals == stats.literals && matches == stats.matches && finds == stats.finds,
+				"%s of %zu bytes: the chunks do not add up to the totals", corpus_names[type], len);
+		}
+
+		// The reused context has compressed other data before, with and without statistics
+		err = xpress_huff_compress_ctx(reused, in, len, out2, &out_len2, &stats2);
+		TEST_CHECK(err == 0 && out_len2 == out_len && memcmp(out, out2, out_len) == 0, "%s of %zu bytes: the reused context compressed differently", corpus_names[type], len);
+		TEST_CHECK(stats2.in_len == stats.in_len && stats2.out_len == stats.out_len && stats2.chunks == stats.chunks && stats2.literals == stats.literals &&
+			stats2.matches == stats.matches && stats2.finds == stats.finds && stats2.chain_steps == stats.chain_steps && stats2.nice_hits == stats.nice_hits,
+			"%s of %zu bytes: the reused context reported other statistics", corpus_names[type], len);
+	}
+	xpress_huff_ctx_free(ctx);
+	free(in); free(out); free(out2); free(dec);
+}
+
+int main(void)
+{
+	xpress_huff_ctx* reused = xpress_huff_ctx_new();
+	TEST_CHECK(reused != NULL, "out of memory");
+	if (reused == NULL) { return test_done("stats"); }
+	for (int type = 0; type < CORPUS_COUNT; ++type)
+	{
+		for (size_t i = 0; i < TEST_SIZES; ++i)
+		{
+			test_stats(reused, (corpus_type)type, test_sizes[i]);
+
+			// Compress something else without statistics so that the next call starts after it
+			uint8_t junk[5000], out[6000];
+			size_t out_len = sizeof(out);
+			corpus_generate((corpus_type)type, junk, sizeof(junk), 7);
+			xpress_huff_compress_ctx(reused, junk, sizeof(junk), out, &out_len, NULL);
+		}
+	}
+	xpress_huff_ctx_free(reused);
+	return test_done("stats");
+}
@@ -0,0 +1,70 @@
+// ms-compress: implements Microsoft compression algorithms
+// Copyright (C) 2018 David Mulder <dmulder@suse.com>
+//
+// This library is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This library is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+
+////////////////////////////// Test Helpers ////////////////////////////////////////////////////////
+// Shared by the tests: every failed check is printed with its location and counted, and the inputs
+// are the synthetic corpora of the benchmarks (see bench/corpus.h) at sizes around the chunk and
+// window boundaries of the formats.
+
+#ifndef MSCOMP_TEST_H
+#define MSCOMP_TEST_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+#include "../bench/corpus.h"
+
+static unsigned test_failures = 0;
+
+#define TEST_CHECK(cond, ...)                                               \
+	do                                                                      \
+	{                                                                       \
+		if (!(cond))                                                        \
+		{                                                                   \
+			fprintf(stderr, "%s:%d: %s failed: ", __FILE__, __LINE__, #cond); \
+			fprintf(stderr, __VA_ARGS__);                                   \
+			fputc('\n', stderr);                                            \
+			++test_failures;                                                \
+		}                                                                   \
+	} while (0)
+
+#define TEST_SIZES		21
+static const size_t test_sizes[TEST_SIZES] =
+{
+	1, 2, 3, 4, 31, 32, 33, 255, 256, 4095, 4096, 4097, 8191, 8192, 8193, 65535, 65536, 65537, 131073, 200000, 1000000
+};
+
+// Returns a new buffer of len bytes of the given corpus type (exits if out of memory)
+static inline uint8_t* test_corpus(corpus_type type, size_t len)
+{
+	uint8_t* buf = (uint8_t*)malloc(len ? len : 1);
+	if (buf == NULL) { fprintf(stderr, "out of memory\n"); exit(2); }
+	corpus_generate(type, buf, len, 1);
+	return buf;
+}
+
+// Prints the result of the test and returns the exit code for main
+static inline int test_done(const char* name)
+{
+	if (test_failures) { printf("%s: %u failed\n", name, test_failures); return 1; }
+	printf("%s: ok\n", name);
+	return 0;
+}
+
+#endif
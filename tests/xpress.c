@@ -0,0 +1,67 @@
+// ms-compress: implements Microsoft compression algorithms
+// Copyright (C) 2018 David Mulder <dmulder@suse.com>
+//
+// This library is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This library is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+
+////////////////////////////// Xpress Test /////////////////////////////////////////////////////////
+// Compresses every corpus at every test size with xpress_compress and checks that the output
+// decompresses to the input, is within xpress_max_compressed_size and that an output buffer of
+// exactly the compressed size works while one byte less fails with ENOBUFS.
+
+#include "test.h"
+#include "xpress_decode.h"
+#include "../src/xpress_compress.h"
+
+static void test_xpress(corpus_type type, size_t len)
+{
+	const size_t max_len = xpress_max_compressed_size(len);
+	uint8_t* in = test_corpus(type, len), * dec = (uint8_t*)malloc(len), * out = (uint8_t*)malloc(max_len), * out2 = (uint8_t*)malloc(max_len);
+	TEST_CHECK(dec && out && out2, "out of memory");
+	if (dec && out && out2)
+	{
+		size_t out_len = max_len, dec_len = len;
+		int err = xpress_compress(in, len, out, &out_len);
+		TEST_CHECK(err == 0, "%s of %zu bytes: error %d", corpus_names[type], len, err);
+		if (err == 0)
+		{
+			TEST_CHECK(out_len <= max_len, "%s of %zu bytes: %zu bytes is over the maximum of %zu", corpus_names[type], len, out_len, max_len);
+			TEST_CHECK(test_xpress_decompress(out, out_len, dec, &dec_len) == 0 && dec_len == len && memcmp(in, dec, len) == 0,
+				"%s of %zu bytes does not decompress", corpus_names[type], len);
+
+			size_t out2_len = out_len;
+			err = xpress_compress(in, len, out2, &out2_len);
+			TEST_CHECK(err == 0 && out2_len == out_len && memcmp(out, out2, out_len) == 0, "%s of %zu bytes into exactly %zu bytes: error %d", corpus_names[type], len, out_len, err);
+			out2_len = out_len - 1;
+			err = xpress_compress(in, len, out2, &out2_len);
+			TEST_CHECK(err == ENOBUFS, "%s of %zu bytes into %zu bytes: error %d", corpus_names[type], len, out_len - 1, err);
+		}
+	}
+	free(in); free(dec); free(out); free(out2);
+}
+
+int main(void)
+{
+	for (int type = 0; type < CORPUS_COUNT; ++type)
+	{
+		for (size_t i = 0; i < TEST_SIZES; ++i) { test_xpress((corpus_type)type, test_sizes[i]); }
+	}
+
+	// Nothing compresses to nothing
+	uint8_t out[4];
+	size_t out_len = sizeof(out);
+	TEST_CHECK(xpress_compress(out, 0, out, &out_len) == 0 && out_len == 0, "%zu bytes for no input", out_len);
+
+	return test_done("xpress");
+}
@@ -0,0 +1,89 @@
+// ms-compress: implements Microsoft compression algorithms
+// Copyright (C) 2018 David Mulder <dmulder@suse.com>
+//
+// This library is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This library is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+
+////////////////////////////// Xpress Decompression ////////////////////////////////////////////////
+// A plain decompressor following MS-XCA 2.4, independent of the compressor, so that the tests can
+// check that compressed data decompresses to the input. Written for clarity, not speed.
+
+#ifndef MSCOMP_TEST_XPRESS_DECODE_H
+#define MSCOMP_TEST_XPRESS_DECODE_H
+
+#include "../src/mscomp_endian.h"
+
+// Decompresses in into out, which has room for *out_len bytes, setting *out_len to the number of
+// bytes written. Returns 0 or -1 if in is not valid or does not fit.
+static inline int test_xpress_decompress(const uint8_t* in, size_t in_len, uint8_t* out, size_t* out_len)
+{
+	const uint8_t* const in_end = in + in_len, * half = NULL; // half is the byte holding a spare length nibble
+	size_t out_pos = 0;
+	uint32_t flags = 0;
+	unsigned flag_count = 0;
+	for (;;)
+	{
+		if (flag_count == 0)
+		{
+			if (in_end - in < 4) { return -1; }
+			flags = GET_UINT32(in); in += 4;
+			flag_count = 32;
+		}
+		--flag_count;
+		if (!(flags & (1u << flag_count)))
+		{
+			// A literal
+			if (in == in_end || out_pos == *out_len) { return -1; }
+			out[out_pos++] = *in++;
+			continue;
+		}
+
+		// A match, or the end of the stream when there is no more input
+		if (in == in_end) { *out_len = out_pos; return 0; }
+		if (in_end - in < 2) { return -1; }
+		const uint32_t sym = GET_UINT16(in), off = (sym >> 3) + 1;
+		uint32_t len = sym & 7;
+		in += 2;
+		if (len == 7)
+		{
+			// The lengths of two matches share a byte: the first one uses its low nibble
+			if (half == NULL) { if (in == in_end) { return -1; } len = *in & 0xF; half = in++; }
+			else { len = *half >> 4; half = NULL; }
+			if (len == 0xF)
+			{
+				if (in == in_end) { return -1; }
+				len = *in++;
+				if (len == 0xFF)
+				{
+					if (in_end - in < 2) { return -1; }
+					len = GET_UINT16(in); in += 2;
+					if (len == 0)
+					{
+						if (in_end - in < 4) { return -1; }
+						len = GET_UINT32(in); in += 4;
+					}
+					if (len < 0xF + 7) { return -1; }
+					len -= 0xF + 7;
+				}
+				len += 0xF;
+			}
+			len += 7;
+		}
+		len += 3;
+		if (off > out_pos || len > *out_len - out_pos) { return -1; }
+		for (uint32_t i = 0; i < len; ++i, ++out_pos) { out[out_pos] = out[out_pos - off]; }
+	}
+}
+
+#endif
@@ -0,0 +1,127 @@
+// ms-compress: implements Microsoft compression algorithms
+// Copyright (C) 2018 David Mulder <dmulder@suse.com>
+//
+// This library is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This library is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+
+////////////////////////////// Xpress Huffman Decompression ////////////////////////////////////////
+// A plain decompressor following MS-XCA 2.2.4, independent of the compressor, so that the tests can
+// check that compressed data decompresses to the input. Written for clarity, not speed.
+
+#ifndef MSCOMP_TEST_XPRESS_HUFF_DECODE_H
+#define MSCOMP_TEST_XPRESS_HUFF_DECODE_H
+
+#include "../src/mscomp_endian.h"
+
+#define TEST_XH_TABLE_BITS	15
+#define TEST_XH_NO_SYMBOL	0xFFFF
+
+// Decompresses in, which has to be the compression of exactly out_len bytes ending with the end of
+// stream symbol, after a history of hist_len bytes that matches can refer to (a preset dictionary).
+// out holds the history and is followed by room for the output. Returns 0 or -1 if in is not valid.
+static inline int test_xpress_huff_decompress_hist(const uint8_t* in, size_t in_len, uint8_t* out, size_t hist_len, size_t out_len)
+{
+	static uint16_t table[1 << TEST_XH_TABLE_BITS]; // the symbol of every 15-bit prefix
+	const uint8_t* const in_end = in + in_len;
+	size_t out_pos = hist_len;
+	out_len += hist_len;
+	for (;;)
+	{
+		////////// Read the code lengths and build the decoding table //////////
+		uint8_t lens[0x200];
+		if (in_end - in < 256 + 4) { return -1; }
+		for (uint_fast16_t i = 0; i < 0x100; ++i) { lens[2*i] = in[i] & 0xF; lens[2*i+1] = in[i] >> 4; }
+		in += 0x100;
+		uint32_t pos = 0;
+		for (uint_fast8_t len = 1; len <= TEST_XH_TABLE_BITS; ++len)
+		{
+			for (uint_fast16_t sym = 0; sym < 0x200; ++sym)
+			{
+				if (lens[sym] != len) { continue; }
+				const uint32_t n = 1u << (TEST_XH_TABLE_BITS - len);
+				if (pos + n > (1u << TEST_XH_TABLE_BITS)) { return -1; }
+				for (uint32_t i = 0; i < n; ++i) { table[pos++] = (uint16_t)sym; }
+			}
+		}
+		while (pos < (1u << TEST_XH_TABLE_BITS)) { table[pos++] = TEST_XH_NO_SYMBOL; }
+
+		////////// Decode the symbols of the chunk //////////
+		uint32_t bits = ((uint32_t)GET_UINT16(in) << 16) | GET_UINT16(in + 2);
+		int extra = 16;
+		in += 4;
+		const size_t chunk_end = out_pos + 0x10000;
+		for (;;)
+		{
+			uint_fast16_t sym = table[bits >> (32 - TEST_XH_TABLE_BITS)];
+			if (out_pos == out_len)
+			{
+				// The end of stream symbol ends the last chunk or is in a chunk of its own
+				if (sym == 0x100) { return 0; }
+				if (out_pos < chunk_end) { return -1; }
+				break;
+			}
+			if (out_pos >= chunk_end) { break; }
+			if (sym == TEST_XH_NO_SYMBOL) { return -1; }
+			bits <<= lens[sym]; extra -= lens[sym];
+			if (extra < 0)
+			{
+				if (in_end - in < 2) { return -1; }
+				bits |= (uint32_t)GET_UINT16(in) << -extra; extra += 16; in += 2;
+			}
+			if (sym < 0x100) { out[out_pos++] = (uint8_t)sym; continue; }
+
+			// A match: the length is in the low 4 bits of the symbol (with more in bytes when it is 15)
+			// and the number of offset bits in the high 4 bits
+			uint32_t len = sym & 0xF;
+			const unsigned off_bits = (sym >> 4) & 0xF;
+			if (len == 0xF)
+			{
+				if (in_end - in < 1) { return -1; }
+				len = *in++;
+				if (len == 0xFF)
+				{
+					if (in_end - in < 2) { return -1; }
+					len = GET_UINT16(in); in += 2;
+					if (len == 0)
+					{
+						if (in_end - in < 4) { return -1; }
+						len = GET_UINT32(in); in += 4;
+					}
+					if (len < 0xF) { return -1; }
+					len -= 0xF;
+				}
+				len += 0xF;
+			}
+			len += 3;
+			const uint32_t off = (off_bits ? bits >> (32 - off_bits) : 0) | (1u << off_bits);
+			bits <<= off_bits; extra -= off_bits;
+			if (extra < 0)
+			{
+				if (in_end - in < 2) { return -1; }
+				bits |= (uint32_t)GET_UINT16(in) << -extra; extra += 16; in += 2;
+			}
+			if (off > out_pos || len > out_len - out_pos) { return -1; }
+			for (uint32_t i = 0; i < len; ++i, ++out_pos) { out[out_pos] = out[out_pos - off]; }
+		}
+	}
+}
+
+// Decompresses in, which has to be the compression of exactly out_len bytes ending with the end of
+// stream symbol. Returns 0 or -1 if in is not valid.
+static inline int test_xpress_huff_decompress(const uint8_t* in, size_t in_len, uint8_t* out, size_t out_len)
+{
+	return test_xpress_huff_decompress_hist(in, in_len, out, 0, out_len);
+}
+
+#endif
@@ -0,0 +1,181 @@
+// ms-compress: implements Microsoft compression algorithms
+// Copyright (C) 2018 David Mulder <dmulder@suse.com>
+//
+// This library is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This library is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+
+////////////////////////////// xpress-huff Command Line Tool ///////////////////////////////////////
+// Tools for working with the Xpress Huffman compressor.
+//
+// Build (from the repository root):
+//   make xpress-huff
+//
+// Usage:
+//   xpress-huff train [-o dict] [--max-size 64K] [--split N] [--level L] sample...
+//     Trains a preset dictionary from the sample files (see xpress_huff_train_dict) and writes it to
+//     dict (default "dictionary"). Each file is one sample message, or with --split each N bytes of
+//     a file are. Then every sample is compressed with and without the dictionary and the totals are
+//     reported, to show whether the dictionary is worth it. Since the samples were used to train the
+//     dictionary, keep some samples aside to check it on data it has not seen.
+
+#include <errno.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <getopt.h>
+
+#include "../src/xpress_huff_compress.h"
+
+#define MAX_DICT_SIZE		0xFFFF
+
+// Parses sizes like "512", "64K" or "16M" (powers of 1024)
+static size_t xh_parse_size(const char* s)
+{
+	char* end;
+	size_t x = (size_t)strtoull(s, &end, 10);
+	switch (*end)
+	{
+	case 'm': case 'M': x <<= 10; // fallthrough
+	case 'k': case 'K': x <<= 10;
+	}
+	return x;
+}
+
+// Appends the contents of a file to the buffer, growing it as needed. Returns the number of bytes
+// read or (size_t)-1 on failure.
+static size_t xh_read_file(const char* path, uint8_t** buf, size_t* len, size_t* cap)
+{
+	FILE* f = fopen(path, "rb");
+	if (!f) { perror(path); return (size_t)-1; }
+	const size_t start = *len;
+	for (;;)
+	{
+		if (*cap - *len < 0x10000)
+		{
+			uint8_t* p = (uint8_t*)realloc(*buf, *cap = *cap * 2 + 0x10000);
+			if (!p) { fclose(f); fprintf(stderr, "out of memory\n"); return (size_t)-1; }
+			*buf = p;
+		}
+		const size_t n = fread(*buf + *len, 1, *cap - *len, f);
+		*len += n;
+		if (n == 0) { break; }
+	}
+	const int err = ferror(f);
+	fclose(f);
+	if (err) { fprintf(stderr, "%s: read error\n", path); return (size_t)-1; }
+	return *len - start;
+}
+
+// Compresses each sample on its own, returns the total compressed size or (uint64_t)-1 on failure
+static uint64_t xh_compress_samples(xpress_huff_ctx* ctx, const uint8_t* samples, const size_t* lens, size_t n)
+{
+	size_t largest = 0;
+	for (size_t i = 0; i < n; ++i) { if (lens[i] > largest) { largest = lens[i]; } }
+	const size_t cap = xpress_huff_max_compressed_size(largest);
+	uint8_t* out = (uint8_t*)malloc(cap);
+	uint64_t total = 0;
+	if (!out) { return (uint64_t)-1; }
+	for (size_t i = 0; i < n; samples += lens[i++])
+	{
+		size_t out_len = cap;
+		if (xpress_huff_compress_ctx(ctx, samples, lens[i], out, &out_len, NULL) != 0) { total = (uint64_t)-1; break; }
+		total += out_len;
+	}
+	free(out);
+	return total;
+}
+
+static int xh_train_main(int argc, char* argv[])
+{
+	const char* output = "dictionary";
+	size_t max_size = MAX_DICT_SIZE, split = 0;
+	int level = 0;
+
+	static const struct option opts[] = {
+		{ "output", required_argument, NULL, 'o' },
+		{ "max-size", required_argument, NULL, 'm' },
+		{ "split", required_argument, NULL, 's' },
+		{ "level", required_argument, NULL, 'l' },
+		{ NULL, 0, NULL, 0 }
+	};
+	for (int c; (c = getopt_long(argc, argv, "o:m:s:l:", opts, NULL)) != -1; )
+	{
+		switch (c)
+		{
+		case 'o': output = optarg; break;
+		case 'm': max_size = xh_parse_size(optarg); break;
+		case 's': split = xh_parse_size(optarg); break;
+		case 'l': level = atoi(optarg); break;
+		default:
+			fprintf(stderr, "usage: %s train [-o dict] [--max-size N] [--split N] [--level L] sample...\n", argv[0]);
+			return 1;
+		}
+	}
+	if (optind >= argc) { fprintf(stderr, "no samples given\n"); return 1; }
+
+	// Read the samples
+	uint8_t* samples = NULL;
+	size_t len = 0, cap = 0, n = 0, lens_cap = 0;
+	size_t* lens = NULL;
+	for (int i = optind; i < argc; ++i)
+	{
+		size_t file_len = xh_read_file(argv[i], &samples, &len, &cap);
+		if (file_len == (size_t)-1) { return 1; }
+		while (file_len > 0)
+		{
+			const size_t sample_len = (split && split < file_len) ? split : file_len;
+			if (n == lens_cap)
+			{
+				size_t* p = (size_t*)realloc(lens, (lens_cap = lens_cap * 2 + 64) * sizeof(size_t));
+				if (!p) { fprintf(stderr, "out of memory\n"); return 1; }
+				lens = p;
+			}
+			lens[n++] = sample_len;
+			file_len -= sample_len;
+		}
+	}
+
+	// Train the dictionary
+	uint8_t dict[MAX_DICT_SIZE];
+	size_t dict_len = max_size < MAX_DICT_SIZE ? max_size : MAX_DICT_SIZE;
+	int err = xpress_huff_train_dict(samples, lens, n, dict, &dict_len);
+	if (err) { fprintf(stderr, "training failed: %s\n", err == EINVAL ? "not enough sample data" : "out of memory"); return 1; }
+	FILE* f = fopen(output, "wb");
+	if (!f || fwrite(dict, 1, dict_len, f) != dict_len || fclose(f) != 0) { perror(output); return 1; }
+
+	// Report what the dictionary gains on the samples
+	xpress_huff_ctx* ctx = xpress_huff_ctx_new();
+	if (!ctx || xpress_huff_ctx_set_level(ctx, level) != 0) { fprintf(stderr, "invalid level\n"); return 1; }
+	const uint64_t without = xh_compress_samples(ctx, samples, lens, n);
+	err = xpress_huff_ctx_set_dict(ctx, dict, dict_len);
+	const uint64_t with = err ? (uint64_t)-1 : xh_compress_samples(ctx, samples, lens, n);
+	xpress_huff_ctx_free(ctx);
+	if (without == (uint64_t)-1 || with == (uint64_t)-1) { fprintf(stderr, "compression failed\n"); return 1; }
+	printf("samples:            %zu (%zu bytes)\n", n, len);
+	printf("dictionary:         %zu bytes written to %s\n", dict_len, output);
+	printf("without dictionary: %llu bytes (ratio %.4f)\n", (unsigned long long)without, (double)without / len);
+	printf("with dictionary:    %llu bytes (ratio %.4f)\n", (unsigned long long)with, (double)with / len);
+
+	free(samples);
+	free(lens);
+	return 0;
+}
+
+int main(int argc, char* argv[])
+{
+	if (argc >= 2 && strcmp(argv[1], "train") == 0) { return xh_train_main(argc - 1, argv + 1); }
+	fprintf(stderr, "usage: %s train [options] sample...\n", argv[0]);
+	return 1;
+}